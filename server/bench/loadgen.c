@@ -0,0 +1,489 @@
+// loadgen.c
+// Load generator for the line protocol (`make bench`).
+// - N connections spread over T threads, one epoll loop per thread
+// - every connection runs a script, one command in flight at a time:
+//   match pairs play full bo9 games over and over (HELLO, CREATE, JOIN by
+//   both seats, READY, MOVE until GAME_END), lobby connections alternate LIST and PING,
+//   queue connections QUEUE for a quick match and QUEUE again after each GAME_END
+// - --rate caps the commands per second over all threads, 0 = closed loop
+// - latency is send -> last line of the direct reply, kept in the same
+//   log-linear histograms as the server (metrics.h)
+// - prints throughput once per second and a per-command summary at the end
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "metrics.h"
+
+#define RBUF 8192
+#define MAX_EVENTS 256
+#define SEND_MAX 96
+
+typedef enum { B_HELLO, B_LIST, B_CREATE, B_JOIN, B_READY, B_MOVE, B_LEAVE, B_PING, B_QUEUE, B_NCMDS } bcmd_t;
+
+static const char *const bcmd_names[B_NCMDS] = {
+    "HELLO", "LIST", "CREATE", "JOIN", "READY", "MOVE", "LEAVE", "PING", "QUEUE",
+};
+/* first word of the direct reply (ERR ends any command) */
+static const char *const bcmd_reply[B_NCMDS] = {
+    "WELCOME", "ROOM_LIST", "ROOM_CREATED", "ROOM_JOINED", "OK", "MOVE_ACCEPTED", "LEFT", "PONG", "OK",
+};
+
+typedef enum { SC_MATCH, SC_LOBBY, SC_MIXED, SC_QUEUE } scenario_t;
+typedef enum { ROLE_LOBBY, ROLE_HOST, ROLE_GUEST, ROLE_QUEUE } role_t;
+
+typedef struct conn {
+    int fd;
+    int id;
+    role_t role;
+    struct conn *peer; // the other seat of a match pair
+    int dead;
+    char rbuf[RBUF];
+    size_t rlen;
+    int pending;        // bcmd_t in flight, -1 = none
+    uint64_t sent_ns;
+    int list_left;      // ROOM lines still to come for a LIST
+    int in_lobby;       // authenticated and not seated
+    int room;           // host's room the guest should join, 0 = none yet
+    int move_due;       // a ROUND_START came while a command was in flight
+    int lobby_flip;
+    /* next command, waiting for the rate limiter */
+    char next[SEND_MAX];
+    size_t next_len;
+    int next_cmd;
+    struct conn *qnext;
+    int queued;
+} conn_t;
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t done, errors, matches;
+    uint64_t count[B_NCMDS], errs[B_NCMDS], max_ns[B_NCMDS];
+    uint64_t hist[B_NCMDS][METRICS_BUCKETS];
+} stats_t;
+
+typedef struct {
+    pthread_t thread;
+    int idx;
+    int epfd;
+    conn_t *conns;
+    int nconns;
+    conn_t *qhead, *qtail;
+    uint64_t sent, start_ns;
+    double rate; // commands per second for this thread, 0 = unlimited
+    unsigned seed;
+    stats_t st;
+} worker_t;
+
+static struct {
+    const char *host;
+    const char *port;
+    int conns, threads, seconds;
+    double rate;
+    scenario_t scenario;
+} opt = { "127.0.0.1", "10000", 64, 2, 10, 0, SC_MIXED };
+
+static atomic_int stop;
+static struct addrinfo *server_addr;
+
+static void bump(_Atomic uint64_t *p) {
+    atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/* ---- sending ---- */
+
+static void issue(worker_t *w, conn_t *c, bcmd_t cmd, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(c->next, sizeof(c->next) - 2, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= sizeof(c->next) - 2) n = 0;
+    c->next[n++] = '\r';
+    c->next[n++] = '\n';
+    c->next_len = (size_t)n;
+    c->next_cmd = (int)cmd;
+    if (c->queued) return;
+    c->queued = 1;
+    c->qnext = NULL;
+    if (w->qtail) w->qtail->qnext = c;
+    else w->qhead = c;
+    w->qtail = c;
+}
+
+/* send queued commands while the rate allows; ms until the next token, or -1 */
+static int pump(worker_t *w) {
+    while (w->qhead) {
+        uint64_t now = metrics_now_ns();
+        if (w->rate > 0) {
+            double due = (double)(now - w->start_ns) * w->rate / 1e9;
+            double burst = w->rate / 100 + 1; // no catching up after a stall
+            if ((double)w->sent + burst < due) w->sent = (uint64_t)(due - burst);
+            if ((double)w->sent >= due) {
+                int ms = (int)(((double)w->sent + 1 - due) * 1000 / w->rate) + 1;
+                return ms;
+            }
+        }
+        conn_t *c = w->qhead;
+        w->qhead = c->qnext;
+        if (!w->qhead) w->qtail = NULL;
+        c->queued = 0;
+        if (c->dead) continue;
+        ssize_t n = send(c->fd, c->next, c->next_len, MSG_NOSIGNAL);
+        if (n != (ssize_t)c->next_len) { c->dead = 1; continue; } // one short line never fills a socket buffer
+        c->pending = c->next_cmd;
+        c->sent_ns = now;
+        w->sent++;
+    }
+    return -1;
+}
+
+/* ---- scripts ---- */
+
+static void lobby_next(worker_t *w, conn_t *c) {
+    if (c->lobby_flip ^= 1) issue(w, c, B_LIST, "LIST");
+    else issue(w, c, B_PING, "PING");
+}
+
+static void guest_try_join(worker_t *w, conn_t *c) {
+    if (c->role == ROLE_GUEST && c->in_lobby && c->room && c->pending < 0 && !c->queued) {
+        issue(w, c, B_JOIN, "JOIN %d", c->room);
+        c->room = 0;
+    }
+}
+
+static void send_move(worker_t *w, conn_t *c) {
+    static const char moves[] = "RPS";
+    c->move_due = 0;
+    issue(w, c, B_MOVE, "MOVE %c", moves[rand_r(&w->seed) % 3]);
+}
+
+/* the direct reply to c->pending is complete */
+static void on_reply(worker_t *w, conn_t *c, bcmd_t cmd, int ok, const char *line) {
+    switch (cmd) {
+    case B_HELLO:
+        c->in_lobby = 1;
+        if (c->role == ROLE_HOST) issue(w, c, B_CREATE, "CREATE bench%d", c->id);
+        else if (c->role == ROLE_LOBBY) lobby_next(w, c);
+        else if (c->role == ROLE_QUEUE) issue(w, c, B_QUEUE, "QUEUE");
+        break;
+    case B_CREATE:
+        if (!ok) { issue(w, c, B_CREATE, "CREATE bench%d", c->id); break; } // rooms full, retry
+        issue(w, c, B_JOIN, "JOIN %d", atoi(line + sizeof("ROOM_CREATED"))); // CREATE does not seat
+        break;
+    case B_JOIN:
+        if (!ok) break;
+        c->in_lobby = 0;
+        if (c->role == ROLE_GUEST) issue(w, c, B_READY, "READY"); // the host waits for PLAYER_JOINED
+        else {
+            c->peer->room = atoi(line + sizeof("ROOM_JOINED"));
+            guest_try_join(w, c->peer);
+        }
+        break;
+    case B_LIST:
+    case B_PING:
+        lobby_next(w, c);
+        break;
+    default:
+        break;
+    }
+    if (c->move_due && c->pending < 0 && !c->queued) send_move(w, c);
+    guest_try_join(w, c);
+}
+
+/* a line that is not the reply to the command in flight */
+static void on_event(worker_t *w, conn_t *c, const char *line) {
+    if (strncmp(line, "PLAYER_JOINED ", 14) == 0) {
+        if (c->role == ROLE_HOST) issue(w, c, B_READY, "READY");
+    } else if (strncmp(line, "ROUND_START ", 12) == 0) {
+        if (c->pending < 0 && !c->queued) send_move(w, c);
+        else c->move_due = 1;
+    } else if (strncmp(line, "GAME_END ", 9) == 0) {
+        c->in_lobby = 1;
+        c->move_due = 0;
+        if (c->role == ROLE_QUEUE) {
+            char nick[16];
+            snprintf(nick, sizeof(nick), "b%d", c->id);
+            if (strcmp(line + 9, nick) == 0) bump(&w->st.matches); // counted once, by the winner
+            issue(w, c, B_QUEUE, "QUEUE");
+        } else if (c->role == ROLE_HOST) {
+            bump(&w->st.matches);
+            issue(w, c, B_CREATE, "CREATE bench%d", c->id);
+        }
+        guest_try_join(w, c);
+    }
+}
+
+static int reply_matches(bcmd_t cmd, const char *line) {
+    size_t n = strlen(bcmd_reply[cmd]);
+    return strncmp(line, bcmd_reply[cmd], n) == 0 && (line[n] == ' ' || line[n] == '\0');
+}
+
+static void record(worker_t *w, conn_t *c, bcmd_t cmd, int ok) {
+    uint64_t ns = metrics_now_ns() - c->sent_ns;
+    stats_t *st = &w->st;
+    st->count[cmd]++;
+    st->hist[cmd][metrics_bucket(ns)]++;
+    if (ns > st->max_ns[cmd]) st->max_ns[cmd] = ns;
+    bump(&st->done);
+    if (!ok) { st->errs[cmd]++; bump(&st->errors); }
+}
+
+static void on_line(worker_t *w, conn_t *c, const char *line) {
+    int cmd = c->pending;
+    if (cmd == B_LIST && c->list_left > 0 && strncmp(line, "ROOM ", 5) == 0) {
+        if (--c->list_left == 0) {
+            c->pending = -1;
+            record(w, c, B_LIST, 1);
+            on_reply(w, c, B_LIST, 1, line);
+        }
+        return;
+    }
+    if (cmd >= 0 && (reply_matches((bcmd_t)cmd, line) || strncmp(line, "ERR ", 4) == 0)) {
+        int ok = line[0] != 'E' || strncmp(line, "ERR ", 4) != 0;
+        if (cmd == B_LIST && ok && (c->list_left = atoi(line + sizeof("ROOM_LIST"))) > 0) return;
+        c->pending = -1;
+        record(w, c, (bcmd_t)cmd, ok);
+        on_reply(w, c, (bcmd_t)cmd, ok, line);
+        return;
+    }
+    on_event(w, c, line);
+}
+
+static void on_readable(worker_t *w, conn_t *c) {
+    for (;;) {
+        ssize_t n = recv(c->fd, c->rbuf + c->rlen, RBUF - 1 - c->rlen, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) { c->dead = 1; return; }
+        if (n < 0) return;
+        c->rlen += (size_t)n;
+        size_t start = 0;
+        for (;;) {
+            char *nl = memchr(c->rbuf + start, '\n', c->rlen - start);
+            if (!nl) break;
+            size_t end = (size_t)(nl - c->rbuf);
+            if (end > start && c->rbuf[end-1] == '\r') c->rbuf[end-1] = '\0';
+            *nl = '\0';
+            on_line(w, c, c->rbuf + start);
+            start = end + 1;
+        }
+        memmove(c->rbuf, c->rbuf + start, c->rlen - start);
+        c->rlen -= start;
+        if (c->rlen == RBUF - 1) { c->dead = 1; return; } // no reply line is that long
+    }
+}
+
+/* ---- threads ---- */
+
+static int open_conn(void) {
+    int fd = socket(server_addr->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, server_addr->ai_addr, server_addr->ai_addrlen) < 0) { close(fd); return -1; }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int fl = fcntl(fd, F_GETFL);
+    if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0) { close(fd); return -1; }
+    return fd;
+}
+
+static role_t role_of(int i) {
+    switch (opt.scenario) {
+    case SC_LOBBY: return ROLE_LOBBY;
+    case SC_MATCH: return i % 2 ? ROLE_GUEST : ROLE_HOST;
+    case SC_QUEUE: return ROLE_QUEUE;
+    case SC_MIXED: break;
+    }
+    if (i % 4 >= 2) return ROLE_LOBBY; // half the connections play, half browse
+    return i % 2 ? ROLE_GUEST : ROLE_HOST;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    w->start_ns = metrics_now_ns();
+    for (int i=0;i<w->nconns;i++) {
+        conn_t *c = &w->conns[i];
+        if (c->dead) continue;
+        issue(w, c, B_HELLO, "HELLO b%d", c->id);
+    }
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        int timeout = pump(w);
+        if (timeout < 0 || timeout > 100) timeout = 100; // notice stop
+        int n = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+        for (int i=0;i<n;i++) {
+            conn_t *c = events[i].data.ptr;
+            if (!c->dead) on_readable(w, c);
+        }
+    }
+    /* QUIT so the server keeps no sessions around for us */
+    for (int i=0;i<w->nconns;i++) {
+        conn_t *c = &w->conns[i];
+        if (c->fd < 0) continue;
+        send(c->fd, "QUIT\r\n", 6, MSG_NOSIGNAL);
+        close(c->fd);
+    }
+    return NULL;
+}
+
+static int setup_worker(worker_t *w, int first, int n) {
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    w->conns = calloc((size_t)n, sizeof(conn_t));
+    if (w->epfd < 0 || !w->conns) return -1;
+    w->nconns = n;
+    w->seed = (unsigned)(first * 2654435761u + 1);
+    w->rate = opt.rate / opt.threads;
+    int failed = 0;
+    for (int i=0;i<n;i++) {
+        conn_t *c = &w->conns[i];
+        c->id = first + i;
+        c->role = role_of(c->id);
+        c->pending = -1;
+        if (c->role == ROLE_HOST && i + 1 < n) { c->peer = c + 1; c[1].peer = c; }
+        if ((c->role == ROLE_HOST || c->role == ROLE_GUEST) && !c->peer) c->role = ROLE_LOBBY; // odd one out
+        c->fd = open_conn();
+        if (c->fd < 0) { c->dead = 1; failed++; continue; }
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = c };
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    }
+    return failed;
+}
+
+/* ---- report ---- */
+
+static double quantile_us(const uint64_t *hist, uint64_t n, double q) {
+    uint64_t rank = (uint64_t)(q * (double)n), seen = 0;
+    if (rank >= n) rank = n - 1;
+    for (int i=0;i<METRICS_BUCKETS;i++) {
+        seen += hist[i];
+        if (seen > rank) return (double)metrics_bucket_upper(i) / 1e3;
+    }
+    return (double)metrics_bucket_upper(METRICS_BUCKETS - 1) / 1e3;
+}
+
+static void report(worker_t *ws, double secs) {
+    static stats_t total;
+    uint64_t matches = 0;
+    for (int t=0;t<opt.threads;t++) {
+        stats_t *st = &ws[t].st;
+        matches += atomic_load(&st->matches);
+        for (int c=0;c<B_NCMDS;c++) {
+            total.count[c] += st->count[c];
+            total.errs[c] += st->errs[c];
+            if (st->max_ns[c] > total.max_ns[c]) total.max_ns[c] = st->max_ns[c];
+            for (int i=0;i<METRICS_BUCKETS;i++) total.hist[c][i] += st->hist[c][i];
+        }
+    }
+    uint64_t all = 0;
+    printf("\n%-8s %10s %10s %8s %10s %10s %10s %10s\n", "cmd", "count", "per_s", "errors", "p50_us", "p99_us",
+           "p999_us", "max_us");
+    for (int c=0;c<B_NCMDS;c++) {
+        uint64_t n = total.count[c];
+        all += n;
+        if (n == 0) continue;
+        printf("%-8s %10llu %10.0f %8llu %10.1f %10.1f %10.1f %10.1f\n", bcmd_names[c], (unsigned long long)n,
+               (double)n / secs, (unsigned long long)total.errs[c], quantile_us(total.hist[c], n, 0.5),
+               quantile_us(total.hist[c], n, 0.99), quantile_us(total.hist[c], n, 0.999),
+               (double)total.max_ns[c] / 1e3);
+    }
+    printf("%-8s %10llu %10.0f   matches %llu (%.1f/s)\n", "total", (unsigned long long)all, (double)all / secs,
+           (unsigned long long)matches, (double)matches / secs);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--host H] [--port P] [--conns N] [--threads T] [--duration S]\n"
+                    "          [--rate CMDS_PER_S] [--scenario match|lobby|mixed|queue]\n", prog);
+    fprintf(stderr, "  defaults: 127.0.0.1:10000, 64 connections, 2 threads, 10 s, unlimited rate, mixed\n");
+    fprintf(stderr, "  the server disconnects connections over its --cmd-rate: start it with --cmd-rate 0\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static const struct option longopts[] = {
+        { "host", required_argument, NULL, 'H' },
+        { "port", required_argument, NULL, 'p' },
+        { "conns", required_argument, NULL, 'c' },
+        { "threads", required_argument, NULL, 't' },
+        { "duration", required_argument, NULL, 'd' },
+        { "rate", required_argument, NULL, 'r' },
+        { "scenario", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 }
+    };
+    int ch;
+    while ((ch = getopt_long(argc, argv, "H:p:c:t:d:r:s:", longopts, NULL)) != -1) {
+        switch (ch) {
+        case 'H': opt.host = optarg; break;
+        case 'p': opt.port = optarg; break;
+        case 'c': opt.conns = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.seconds = atoi(optarg); break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 's':
+            if (strcmp(optarg, "match") == 0) opt.scenario = SC_MATCH;
+            else if (strcmp(optarg, "lobby") == 0) opt.scenario = SC_LOBBY;
+            else if (strcmp(optarg, "mixed") == 0) opt.scenario = SC_MIXED;
+            else if (strcmp(optarg, "queue") == 0) opt.scenario = SC_QUEUE;
+            else usage(argv[0]);
+            break;
+        default: usage(argv[0]);
+        }
+    }
+    if (opt.conns < 1 || opt.threads < 1 || opt.seconds < 1 || opt.rate < 0) usage(argv[0]);
+    if (opt.threads > opt.conns) opt.threads = opt.conns;
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int err = getaddrinfo(opt.host, opt.port, &hints, &server_addr);
+    if (err) { fprintf(stderr, "%s: %s\n", opt.host, gai_strerror(err)); return 1; }
+
+    worker_t *ws = calloc((size_t)opt.threads, sizeof(worker_t));
+    if (!ws) { perror("calloc"); return 1; }
+    int failed = 0, first = 0;
+    for (int t=0;t<opt.threads;t++) {
+        /* even shares keep match pairs on one thread */
+        int n = opt.conns / opt.threads + (t < opt.conns % opt.threads);
+        if (n % 2 && t + 1 < opt.threads) n++;
+        if (first + n > opt.conns) n = opt.conns - first;
+        ws[t].idx = t;
+        int f = setup_worker(&ws[t], first, n);
+        if (f < 0) { perror("setup"); return 1; }
+        failed += f;
+        first += n;
+    }
+    if (failed) fprintf(stderr, "%d of %d connections failed\n", failed, opt.conns);
+    if (failed == opt.conns) return 1;
+
+    uint64_t t0 = metrics_now_ns();
+    for (int t=0;t<opt.threads;t++) {
+        if (pthread_create(&ws[t].thread, NULL, worker_main, &ws[t]) != 0) { perror("pthread_create"); return 1; }
+    }
+    uint64_t last_done = 0, last_matches = 0;
+    for (int s=1;s<=opt.seconds;s++) {
+        sleep(1);
+        uint64_t done = 0, errors = 0, matches = 0;
+        for (int t=0;t<opt.threads;t++) {
+            done += atomic_load_explicit(&ws[t].st.done, memory_order_relaxed);
+            errors += atomic_load_explicit(&ws[t].st.errors, memory_order_relaxed);
+            matches += atomic_load_explicit(&ws[t].st.matches, memory_order_relaxed);
+        }
+        printf("t=%ds cmds/s=%llu matches/s=%llu errors=%llu\n", s, (unsigned long long)(done - last_done),
+               (unsigned long long)(matches - last_matches), (unsigned long long)errors);
+        fflush(stdout);
+        last_done = done;
+        last_matches = matches;
+    }
+    atomic_store(&stop, 1);
+    for (int t=0;t<opt.threads;t++) pthread_join(ws[t].thread, NULL);
+    report(ws, (double)(metrics_now_ns() - t0) / 1e9);
+    freeaddrinfo(server_addr);
+    return 0;
+}
@@ -0,0 +1,282 @@
+// micro.c
+// Microbenchmarks for the protocol hot paths (`make microbench`).
+// - server.c is compiled into this file (the functions under test are
+//   static); reactor.c is replaced by a stub: one fake reactor on the
+//   calling thread whose output goes to a null sink (dropped) or through a
+//   socketpair that is read back after every op
+// - malloc and friends are wrapped at link time (--wrap), so allocs/op
+//   counts the server code only
+// - every case runs MICRO_REPS timed batches after a warm-up and reports the
+//   median, so reruns on an idle machine agree to a few percent
+//
+// usage: micro [substring]  (runs the cases whose name contains it)
+
+#define main server_main // never called; ends in reactor_start() and has no return
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#include "../src/server.c"
+#pragma GCC diagnostic pop
+#undef main
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define MICRO_ITERS 200000
+#define MICRO_REPS 7
+#define MICRO_ROOMS 1024
+
+/* ---- allocation counting ---- */
+
+static uint64_t allocs;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t k, size_t n);
+void *__real_realloc(void *p, size_t n);
+void *__real_aligned_alloc(size_t a, size_t n);
+
+void *__wrap_malloc(size_t n) { allocs++; return __real_malloc(n); }
+void *__wrap_calloc(size_t k, size_t n) { allocs++; return __real_calloc(k, n); }
+void *__wrap_realloc(void *p, size_t n) { allocs++; return __real_realloc(p, n); }
+void *__wrap_aligned_alloc(size_t a, size_t n) { allocs++; return __real_aligned_alloc(a, n); }
+
+/* ---- stub reactor ---- */
+
+static timer_wheel_t wheel;
+static struct { void (*fn)(uint64_t); uint64_t arg; } calls[256];
+static int ncalls;
+
+void reactor_init(int nworkers, const int *listen_fds) { (void)nworkers; (void)listen_fds; abort(); }
+void reactor_start(void (*on_start)(void)) { (void)on_start; abort(); }
+client_t *reactor_adopt(int idx, int fd, const char *pending, size_t len) { (void)idx; (void)fd; (void)pending; (void)len; abort(); }
+int reactor_quiesce(int timeout_ms) { (void)timeout_ms; abort(); }
+void reactor_resume(void) { abort(); }
+int reactor_index(void) { return 0; }
+int reactor_current(void) { return 0; }
+int reactor_count(void) { return 1; }
+uint64_t reactor_now_ms(void) { return 0; }
+void reactor_timer_arm(tw_timer_t *t, uint64_t delay_ms) { tw_arm(&wheel, t, delay_ms); }
+void reactor_timer_cancel(tw_timer_t *t) { tw_cancel(&wheel, t); }
+
+void reactor_call(int dst, void (*fn)(uint64_t arg), uint64_t arg) {
+    (void)dst;
+    if (ncalls < (int)(sizeof(calls) / sizeof(calls[0]))) calls[ncalls++] = (typeof(calls[0])){ fn, arg };
+}
+
+/* what the loop would do after the event: deferred calls, then the flush */
+static void run_calls(void) {
+    for (int i=0;i<ncalls;i++) calls[i].fn(calls[i].arg);
+    ncalls = 0;
+}
+
+int conn_write(client_t *c, const char *data, size_t len) { return outq_append(&c->out, data, len); }
+char *conn_reserve(client_t *c, size_t n) { return outq_reserve(&c->out, n); }
+void conn_commit(client_t *c, size_t n) { outq_commit(&c->out, n); }
+int conn_write_shared(client_t *c, snapshot_t *s) { return outq_append_shared(&c->out, s); }
+void conn_drop(client_t *c) { c->dead = 1; }
+
+int client_send(client_ref_t to, const char *data, size_t len) {
+    client_t *c = client_lookup(to);
+    return c ? conn_write(c, data, len) : -1;
+}
+
+int client_send_shared(client_ref_t to, snapshot_t *s) {
+    client_t *c = client_lookup(to);
+    return c ? conn_write_shared(c, s) : -1;
+}
+
+int client_send_lossy(client_ref_t to, snapshot_t *s, size_t max_queued) {
+    client_t *c = client_lookup(to);
+    return c && c->out.bytes <= max_queued ? conn_write_shared(c, s) : -1;
+}
+
+/* ---- sinks ---- */
+
+static client_t *cli;
+static int sink_fd[2] = { -1, -1 }; // [0] is the client socket, [1] the far end
+
+static void drain_null(void) {
+    run_calls();
+    outq_clear(&cli->out);
+}
+
+static void drain_socket(void) {
+    static char buf[1 << 16];
+    run_calls();
+    outq_flush(&cli->out, sink_fd[0]);
+    while (read(sink_fd[1], buf, sizeof(buf)) > 0) {}
+}
+
+/* ---- cases ---- */
+
+static volatile uint64_t sink; // keeps results alive
+static int room_ids[MICRO_ROOMS];
+static uint32_t rng = 12345;
+
+static uint32_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void op_parse(void) {
+    static const char line[] = "JOIN 123456";
+    tok_t arg[3];
+    int argc = tokenize(line, sizeof(line) - 1, arg, 3);
+    sink += (uint64_t)argc + lookup_cmd(arg[0]) + (uint64_t)tok_to_int(arg[1]);
+}
+
+static void op_ping_null(void) { handle_line(cli, "PING", 4); drain_null(); }
+static void op_ping_socket(void) { handle_line(cli, "PING", 4); drain_socket(); }
+static void op_unknown_null(void) {
+    cli->invalid = 0; // the stub clock never ends an INVALID_WINDOW_MS
+    handle_line(cli, "FROB x", 6);
+    drain_null();
+}
+static void op_move_null(void) { handle_line(cli, "MOVE R", 6); drain_null(); } // not seated: ERR 105
+
+static void op_frame_move_null(void) { handle_frame(cli, "\x07\x03R", 3); drain_null(); } // MOVE R
+
+static void op_encode_frame(void) {
+    static const char line[] = "ROUND_RESULT WINNER somebody R S 3 2";
+    uint8_t frame[CODEC_LINE_OUT];
+    sink += codec_encode_line(line, sizeof(line) - 1, frame);
+}
+
+static void op_send_line_null(void) {
+    send_line(cli, "ROUND_RESULT WINNER %s %c %c %d %d", "somebody", 'R', 'S', 3, 2);
+    drain_null();
+}
+
+static void op_round_result_null(void) {
+    static room_t r = { .nicks = { "somebody", "other" }, .game.score = { 3, 2 } };
+    char line[LINE_BUF];
+    send_bytes(cli, line, round_result_line(line, &r, ROUND_SEAT0, 'R', 'S'));
+    drain_null();
+}
+
+static void op_token(void) {
+    char tok[TOKEN_LEN+1];
+    token_generate(tok);
+    sink += (uint64_t)tok[0];
+}
+
+static void op_list_cached_socket(void) { handle_line(cli, "LIST", 4); drain_socket(); }
+
+static void op_list_page_socket(void) { handle_line(cli, "LIST OPEN 500 20", 16); drain_socket(); }
+
+static void op_list_rebuild(void) {
+    pthread_mutex_lock(&room_list_lock);
+    snapshot_t *s = build_room_list();
+    pthread_mutex_unlock(&room_list_lock);
+    sink += s->len;
+    snapshot_put(s);
+}
+
+static void op_room_lookup(void) {
+    room_t *r = lock_room_by_id(room_ids[next_rand() % MICRO_ROOMS]);
+    if (r) { sink += r->slot; pthread_mutex_unlock(&r->lock); }
+}
+
+typedef struct {
+    const char *name;
+    void (*op)(void);
+    int iters; // 0 = MICRO_ITERS
+} micro_case_t;
+
+static const micro_case_t cases[] = {
+    { "parse JOIN (tokenize+lookup)", op_parse, 0 },
+    { "handle_line PING, null sink", op_ping_null, 0 },
+    { "handle_line PING, socketpair", op_ping_socket, 0 },
+    { "handle_line unknown cmd, null", op_unknown_null, 0 },
+    { "handle_line MOVE unseated, null", op_move_null, 0 },
+    { "handle_frame MOVE unseated, null", op_frame_move_null, 0 },
+    { "codec_encode_line ROUND_RESULT", op_encode_frame, 0 },
+    { "send_line ROUND_RESULT, null", op_send_line_null, 0 },
+    { "round_result_line + send_bytes, null", op_round_result_null, 0 },
+    { "token_generate", op_token, 0 },
+    { "LIST cached 1024 rooms, socketpair", op_list_cached_socket, 20000 },
+    { "LIST OPEN 500 20, socketpair", op_list_page_socket, 0 },
+    { "build_room_list 1024 rooms", op_list_rebuild, 2000 },
+    { "lock_room_by_id", op_room_lookup, 0 },
+};
+
+static uint64_t cycles(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_case(const micro_case_t *mc) {
+    int iters = mc->iters ? mc->iters : MICRO_ITERS;
+    double cyc[MICRO_REPS], ns[MICRO_REPS];
+    for (int i=0;i<iters/10;i++) mc->op(); // warm caches and pools
+    uint64_t a0 = allocs;
+    for (int r=0;r<MICRO_REPS;r++) {
+        uint64_t t0 = now_ns(), c0 = cycles();
+        for (int i=0;i<iters;i++) mc->op();
+        uint64_t c1 = cycles(), t1 = now_ns();
+        cyc[r] = (double)(c1 - c0) / iters;
+        ns[r] = (double)(t1 - t0) / iters;
+    }
+    double aop = (double)(allocs - a0) / ((double)iters * MICRO_REPS);
+    qsort(cyc, MICRO_REPS, sizeof(double), cmp_double);
+    qsort(ns, MICRO_REPS, sizeof(double), cmp_double);
+#ifdef HAVE_TSC
+    printf("%-36s %10.1f %9.1f %10.3f\n", mc->name, cyc[MICRO_REPS/2], ns[MICRO_REPS/2], aop);
+#else
+    printf("%-36s %10s %9.1f %10.3f\n", mc->name, "-", ns[MICRO_REPS/2], aop);
+#endif
+}
+
+static void setup(void) {
+    config.max_rooms = MICRO_ROOMS;
+    config.cmd_rate = 0; // the stub clock stands still: any rate would cut the loop off
+    atomic_store(&log_level, LOG_ERROR);
+    tables_init();
+    tw_init(&wheel, 0);
+    metrics_init(cmd_names, CMD_COUNT);
+    metrics_attach(0); // record like a reactor does
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sink_fd) < 0) { perror("socketpair"); exit(1); }
+    int big = 1 << 20;
+    setsockopt(sink_fd[0], SOL_SOCKET, SO_SNDBUF, &big, sizeof(big));
+    setsockopt(sink_fd[1], SOL_SOCKET, SO_RCVBUF, &big, sizeof(big));
+    cli = aligned_alloc(_Alignof(client_t), sizeof(client_t));
+    memset(cli, 0, sizeof(*cli));
+    cli->fd = sink_fd[0];
+    if (client_open(cli) < 0) { fprintf(stderr, "client_open failed\n"); exit(1); }
+    handle_line(cli, "HELLO bench", 11);
+
+    for (int i=0;i<MICRO_ROOMS;i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "room%d", i);
+        room_ids[i] = create_room(name);
+        if (room_ids[i] < 0) { fprintf(stderr, "create_room failed\n"); exit(1); }
+    }
+    drain_null();
+}
+
+int main(int argc, char **argv) {
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    setup();
+    printf("%-36s %10s %9s %10s\n", "case", "cycles/op", "ns/op", "allocs/op");
+    for (size_t i=0;i<sizeof(cases)/sizeof(cases[0]);i++)
+        if (!filter || strstr(cases[i].name, filter)) run_case(&cases[i]);
+    return 0;
+}
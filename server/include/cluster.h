@@ -0,0 +1,65 @@
+// cluster.h
+// Several nodes behind one lobby (--cluster, --node). Every node serves
+// clients on its own; a room lives on the node that created it and the low
+// bits of its id name that node, as the first token char does for a
+// session, so any node can tell where an id belongs without asking. JOIN,
+// WATCH and RECONNECT for another node's room or session are answered with
+// REDIRECT. A link thread subscribes to every peer's lobby like a client
+// does and mirrors the rooms that peer owns, so LIST and SUBSCRIBE show the
+// whole cluster. Off (cluster_nodes 0) every id and token is what it was.
+
+#ifndef RPS_BO9_CLUSTER_H
+#define RPS_BO9_CLUSTER_H
+
+#include <stddef.h>
+
+#define CLUSTER_MAX_NODES 16          // the node index is one hex char of a token
+#define CLUSTER_HOST_MAX 63
+#define CLUSTER_ROOMS_MAX (1 << 20)   // mirrored rooms of all peers together
+#define CLUSTER_RETRY_MS 2000         // between attempts to reach a peer
+#define CLUSTER_CONNECT_TIMEOUT_MS 2000
+#define CLUSTER_PING_MS 20000         // well inside the peer's KEEPALIVE
+
+typedef struct {
+    char host[CLUSTER_HOST_MAX+1];
+    int port;
+} cluster_node_t;
+
+extern int cluster_nodes;     // 0: not clustered
+extern int cluster_self;      // this node's index into the --cluster list
+extern int cluster_node_bits; // low bits of a room id naming its node
+
+/* parse host:port,host:port,... with self as this node's index; -1 if malformed */
+int cluster_parse(const char *list, int self);
+
+/* start the link thread; on_change runs on it whenever the mirror changes */
+void cluster_start(void (*on_change)(void));
+
+static inline int cluster_room_node(int id) {
+    return id & ((1 << cluster_node_bits) - 1);
+}
+
+/* another node's room: JOIN and WATCH go there. An id naming no node is
+ * nobody's and fails the local lookup. */
+static inline int cluster_remote_room(int id) {
+    int node = cluster_room_node(id);
+    return cluster_nodes && node != cluster_self && node < cluster_nodes;
+}
+
+/* stamp a fresh token (TOKEN_LEN hex chars) with this node */
+void cluster_mark_token(char *token);
+
+/* node a token was issued by, -1 if it names none or we are not clustered */
+int cluster_token_node(const char *token);
+
+const cluster_node_t *cluster_node(int i);
+
+/* append "ROOM ..." lines of every mirrored room at *body + *len, growing
+ * the buffer as needed; returns how many were appended */
+int cluster_format_rooms(char **body, size_t *len, size_t *cap);
+
+/* delta lines received from peers since the last call, for local
+ * subscribers: swaps *buf (capacity *cap, reused) for the filled buffer */
+size_t cluster_take_deltas(char **buf, size_t *cap);
+
+#endif //RPS_BO9_CLUSTER_H
@@ -0,0 +1,56 @@
+// codec.h
+// Binary framing, negotiated with HELLO <nick> BIN: one frame per text line.
+// A frame is a varint length, then an opcode for the line's first word, then
+// one tagged varint per further field: v << 1 for a number, n << 1 | 1 for a
+// string of the n bytes that follow. A number field stands for its decimal
+// form, so a frame says exactly what its line says and both feed the same
+// handlers; the reactor converts at the edges.
+
+#ifndef RPS_BO9_CODEC_H
+#define RPS_BO9_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CODEC_FRAME_MAX 510      // opcode and fields of a client frame: a text line without CRLF
+#define CODEC_LINE_OUT (512 + 16) // worst case frame of a server line, length included
+#define CODEC_OP_WORD 0          // word not in the table: it follows as the first field
+
+typedef struct {
+    int is_num;
+    uint64_t num;
+    const char *p; // string fields: n bytes inside the frame
+    size_t n;
+} codec_field_t;
+
+/* the varint at p; bytes used, 0 if it is cut short or longer than max bytes */
+static inline size_t codec_varint(const uint8_t *p, size_t avail, size_t max, uint64_t *v) {
+    uint64_t x = 0;
+    for (size_t i=0;i<avail && i<max;i++) {
+        x |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) { *v = x; return i + 1; }
+    }
+    return 0;
+}
+
+static inline size_t codec_put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (uint8_t)(v | 0x80); v >>= 7; }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/* frame header at p: 1 with *hdr and *len set, 0 if more bytes are needed,
+ * -1 if it is no valid client frame (empty, or over CODEC_FRAME_MAX) */
+int codec_frame(const uint8_t *p, size_t avail, size_t *hdr, size_t *len);
+
+/* the next field of a frame body: 1 with *f set, 0 at its end, -1 if malformed */
+int codec_field(const uint8_t **p, const uint8_t *end, codec_field_t *f);
+
+/* word of an opcode; NULL for CODEC_OP_WORD and unassigned ones */
+const char *codec_word(uint8_t op);
+
+/* one text line (no CRLF) as a frame into dst, CODEC_LINE_OUT bytes; returns its length */
+size_t codec_encode_line(const char *line, size_t len, uint8_t *dst);
+
+#endif //RPS_BO9_CODEC_H
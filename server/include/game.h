@@ -0,0 +1,70 @@
+// game.h
+// bo9 match state packed into 8 bytes per room. Rounds are resolved with
+// table lookups; nothing here allocates or locks (callers hold the room lock).
+
+#ifndef RPS_BO9_GAME_H
+#define RPS_BO9_GAME_H
+
+#include <stdint.h>
+
+#define GAME_WIN_SCORE 5 // bo9: first to 5
+
+typedef enum { MOVE_NONE, MOVE_R, MOVE_P, MOVE_S } move_t;
+
+/* room state machine from docs/protocol.md */
+typedef enum { ROOM_OPEN, ROOM_WAITING, ROOM_PLAYING, ROOM_PAUSED, ROOM_FINISHED } room_state_t;
+
+typedef enum { ROUND_DRAW, ROUND_SEAT0, ROUND_SEAT1 } round_winner_t;
+
+typedef struct {
+    uint8_t state;    // room_state_t
+    uint8_t flags;    // GAME_READY / GAME_AWAY bits per seat
+    uint8_t move[2];  // move_t per seat for the current round
+    uint8_t score[2];
+    uint16_t round;   // 1-based, 0 before GAME_START
+} game_t;
+
+_Static_assert(sizeof(game_t) == 8, "game_t must stay packed");
+
+#define GAME_READY(seat) (1u << (seat))
+#define GAME_AWAY(seat) (4u << (seat)) // went silent mid-game, seat kept for RECONNECT_WINDOW
+
+/* back to an empty OPEN room */
+void game_reset(game_t *g);
+
+/* seat count changed: OPEN <-> WAITING (no effect once playing) */
+void game_seated(game_t *g, int players);
+
+/* mark a seat ready; 1 if that started the game (round 1), 0 otherwise, -1 if not allowed */
+int game_ready(game_t *g, int seat);
+
+/* record a move; 1 if both seats have moved, 0 if waiting for the other, -1 if not allowed */
+int game_move(game_t *g, int seat, move_t m);
+
+/* score the current round (a missing move loses it), clear moves and
+ * advance; leaves state FINISHED once a seat reaches GAME_WIN_SCORE */
+round_winner_t game_resolve(game_t *g);
+
+/* a seat left mid-game (or never came back): the other seat wins by default.
+ * Returns the winning seat, or -1 if no game was running */
+int game_forfeit(game_t *g, int leaving_seat);
+
+/* a seat went silent mid-game: mark it away and pause. 1 if that paused the
+ * game, 0 if it was already paused (no seat is left), -1 if no game was running */
+int game_pause(game_t *g, int seat);
+
+/* the away seat is back: PAUSED -> PLAYING, the interrupted round starts
+ * over with no moves. -1 if seat was not away */
+int game_resume(game_t *g, int seat);
+
+/* the away seat of a paused game */
+static inline int game_away_seat(const game_t *g) { return (g->flags & GAME_AWAY(0)) ? 0 : 1; }
+
+/* 'R'/'P'/'S' (either case) -> move_t, MOVE_NONE otherwise */
+move_t move_parse(char ch);
+
+static inline char move_char(move_t m) { return "-RPS"[m & 3]; }
+
+const char *room_state_name(room_state_t s);
+
+#endif //RPS_BO9_GAME_H
@@ -0,0 +1,37 @@
+// handoff.h
+// Hot restart transport. A starting server connects to the running one's
+// Unix socket (--handoff PATH) and receives the listening sockets, every
+// open connection and a snapshot of the game state, so a binary upgrade
+// neither refuses a connection nor drops one. This is only the wire:
+// typed records on a SOCK_SEQPACKET socket, so record boundaries survive,
+// with file descriptors attached as SCM_RIGHTS. server.c defines the records.
+
+#ifndef RPS_BO9_HANDOFF_H
+#define RPS_BO9_HANDOFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define HANDOFF_MAX_REC 65536    // payload bytes per record
+#define HANDOFF_MAX_FDS 64       // descriptors per record (a listen fd per worker)
+#define HANDOFF_TIMEOUT_MS 10000 // a peer silent this long aborts the transfer
+
+/* listening socket at path, replacing a stale one; exits on failure */
+int handoff_listen(const char *path);
+
+/* next peer, with send/receive timeouts set; -1 on error */
+int handoff_accept(int lfd);
+
+/* connect to a running server; -1 if nobody listens at path */
+int handoff_connect(const char *path);
+
+/* one record of len bytes with nfds descriptors (duplicated into the peer); 0 or -1 */
+int handoff_send(int fd, uint32_t type, const void *p, size_t len, const int *fds, int nfds);
+
+/* next record into buf (cap bytes) and up to HANDOFF_MAX_FDS descriptors
+ * (close-on-exec) into fds. Payload length, 0 at EOF with *type 0, -1 on
+ * error or timeout. */
+ssize_t handoff_recv(int fd, uint32_t *type, void *buf, size_t cap, int *fds, int *nfds);
+
+#endif //RPS_BO9_HANDOFF_H
@@ -0,0 +1,99 @@
+// journal.h
+// Append-only binary journal of sessions, rooms and match results, for
+// leaderboards and for rebuilding the session table after a restart.
+// Like log.c, every thread appends to its own SPSC ring and one writer
+// thread drains them all: a batch is one write(), and fdatasync() runs at
+// most every --journal-fsync-ms (group commit), so the game path never
+// waits for the disk. A full ring drops the record and counts it.
+//
+// File: an 8-byte file header ("RPSJ", version), then records, each a
+// journal_hdr_t and len payload bytes. Records of one thread keep their
+// order; across threads ts_ms orders them. A crash can leave a torn
+// record at the end, which journal_open() cuts off.
+
+#ifndef RPS_BO9_JOURNAL_H
+#define RPS_BO9_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server.h"
+
+#define JOURNAL_RING_SLOTS 4096 // records per thread, power of two
+#define JOURNAL_RECORD 128      // bytes per ring slot, header included
+#define JOURNAL_POLL_MS 5       // writer poll interval when the rings are empty
+#define DEFAULT_JOURNAL_FSYNC_MS 100
+
+typedef enum {
+    J_SESSION_NEW = 1, // j_session_t: HELLO
+    J_SESSION_SUSPEND, // j_suspend_t: connection lost, kept for RECONNECT
+    J_SESSION_RESUME,  // j_session_t: RECONNECT
+    J_SESSION_END,     // j_session_t: QUIT, or a suspend that found no room
+    J_ROOM_OPEN,       // j_room_t
+    J_ROOM_CLOSE,      // j_room_t, name empty
+    J_ROUND,           // j_round_t
+    J_MATCH_END,       // j_match_t
+} journal_type_t;
+
+typedef struct {
+    uint32_t sum;   // FNV-1a over type, len, ts_ms and the payload
+    uint16_t type;  // journal_type_t
+    uint16_t len;   // payload bytes
+    uint64_t ts_ms; // CLOCK_REALTIME
+} journal_hdr_t;
+
+typedef struct {
+    char token[TOKEN_LEN+1];
+    char nick[NICK_MAX+1];
+} j_session_t;
+
+typedef struct {
+    char token[TOKEN_LEN+1];
+    char nick[NICK_MAX+1];
+    int32_t room_id, seat;
+    uint64_t expires_ms; // CLOCK_REALTIME
+} j_suspend_t;
+
+typedef struct {
+    int32_t room_id;
+    char name[ROOM_NAME_MAX+1];
+} j_room_t;
+
+typedef struct {
+    int32_t room_id;
+    uint16_t round;
+    char move[2];     // 'R', 'P', 'S', '-' for none
+    uint8_t score[2]; // after the round
+} j_round_t;
+
+typedef enum { J_END_WON, J_END_FORFEIT, J_END_ABANDONED } j_end_reason_t;
+
+typedef struct {
+    int32_t room_id;
+    uint16_t rounds;
+    uint8_t winner; // seat
+    uint8_t reason; // j_end_reason_t
+    uint8_t score[2];
+    char nicks[2][NICK_MAX+1];
+} j_match_t;
+
+_Static_assert(sizeof(journal_hdr_t) + sizeof(j_suspend_t) <= JOURNAL_RECORD &&
+               sizeof(journal_hdr_t) + sizeof(j_room_t) <= JOURNAL_RECORD &&
+               sizeof(journal_hdr_t) + sizeof(j_match_t) <= JOURNAL_RECORD, "journal payloads must fit a slot");
+
+/* called per replayed record; p is only valid during the call */
+typedef void (*journal_replay_fn)(const journal_hdr_t *h, const void *p, void *arg);
+
+/* map path read-only and hand every intact record to fn in file order (fn
+ * NULL: no replay), cut off a torn tail, then open it for appending and
+ * start the writer. fsync_ms 0 syncs every batch. Exits on I/O errors.
+ * Returns the number of records replayed. */
+size_t journal_open(const char *path, int fsync_ms, journal_replay_fn fn, void *arg);
+
+/* queue a record; never blocks. A no-op until journal_open() */
+void journal_append(journal_type_t type, const void *p, size_t len);
+
+/* wait (a bounded while) until everything queued is written and synced */
+void journal_flush(void);
+
+#endif //RPS_BO9_JOURNAL_H
@@ -0,0 +1,43 @@
+// log.h
+// Asynchronous key=value logging. Every thread formats into its own SPSC
+// ring; a background writer drains the rings to stderr. A full ring drops
+// the line and counts it, so logging never blocks a reactor.
+//
+//   ts=1730000000.123 lvl=info thr=2 ev=disconnect nick=bob
+//
+// thr is the reactor index, or - on a helper thread (main before the
+// reactors start, the journal writer, the cluster link).
+//
+// LOG() costs one relaxed load when the level is filtered out. The level can
+// be changed at runtime: SIGUSR1 makes the log more verbose, SIGUSR2 less.
+
+#ifndef RPS_BO9_LOG_H
+#define RPS_BO9_LOG_H
+
+#include <stdatomic.h>
+
+#define LOG_RING_SLOTS 512 // records per thread, power of two
+#define LOG_RECORD 256     // bytes per record, header included
+#define LOG_FLUSH_MS 10    // writer poll interval when the rings are empty
+
+typedef enum { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR } log_level_t;
+
+extern atomic_int log_level;
+
+#define LOG_ENABLED(lvl) ((int)(lvl) >= atomic_load_explicit(&log_level, memory_order_relaxed))
+
+/* ev is a bare word; fmt carries the rest as " key=value" pairs (values without spaces) */
+#define LOG(lvl, ev, ...) do { if (LOG_ENABLED(lvl)) log_write(lvl, ev, __VA_ARGS__); } while (0)
+
+void log_write(log_level_t lvl, const char *ev, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/* "debug".."error" -> level, -1 if unknown */
+int log_parse_level(const char *s);
+
+/* start the writer thread and the SIGUSR1/SIGUSR2 handlers */
+void log_init(log_level_t lvl);
+
+/* wait (a bounded while) until the writer has written every queued line; before exiting */
+void log_flush(void);
+
+#endif //RPS_BO9_LOG_H
@@ -0,0 +1,55 @@
+// mailbox.h
+// Lock-free single-producer/single-consumer ring used between reactors.
+// Each reactor owns one inbox per peer, so every ring has exactly one
+// writer thread and one reader thread.
+
+#ifndef RPS_BO9_MAILBOX_H
+#define RPS_BO9_MAILBOX_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "snapshot.h"
+
+#define MAILBOX_SIZE 1024 // power of two; overflow spills on the producer side
+#define CACHELINE 64
+
+typedef enum { MAIL_DELIVER, MAIL_SHARED, MAIL_CALL } mail_kind_t;
+
+typedef struct {
+    mail_kind_t kind;
+    uint64_t to;   // client_ref_t of the recipient; MAIL_CALL: fn's argument
+    char *data;    // heap copy, owned by the consumer after pop
+    size_t len;               // MAIL_SHARED: drop it if more than this is queued for the recipient
+    snapshot_t *shared;       // MAIL_SHARED only: one reference, owned like data
+    void (*fn)(uint64_t arg); // MAIL_CALL only
+} mail_t;
+
+typedef struct {
+    _Alignas(CACHELINE) atomic_size_t head; // next slot to pop (consumer)
+    _Alignas(CACHELINE) atomic_size_t tail; // next slot to push (producer)
+    _Alignas(CACHELINE) mail_t slots[MAILBOX_SIZE];
+} mailbox_t;
+
+/* producer side; 0 on success, -1 if the ring is full */
+static inline int mailbox_push(mailbox_t *mb, const mail_t *m) {
+    size_t tail = atomic_load_explicit(&mb->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&mb->head, memory_order_acquire);
+    if (tail - head == MAILBOX_SIZE) return -1;
+    mb->slots[tail & (MAILBOX_SIZE-1)] = *m;
+    atomic_store_explicit(&mb->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/* consumer side; 0 on success, -1 if the ring is empty */
+static inline int mailbox_pop(mailbox_t *mb, mail_t *out) {
+    size_t head = atomic_load_explicit(&mb->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&mb->tail, memory_order_acquire);
+    if (head == tail) return -1;
+    *out = mb->slots[head & (MAILBOX_SIZE-1)];
+    atomic_store_explicit(&mb->head, head + 1, memory_order_release);
+    return 0;
+}
+
+#endif //RPS_BO9_MAILBOX_H
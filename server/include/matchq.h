@@ -0,0 +1,93 @@
+// matchq.h
+// Lock-free bounded multi-producer/multi-consumer ring of QUEUE entries
+// (Vyukov's sequence-numbered cells). Any reactor pushes the clients it
+// queues and any reactor pops them to pair players, so producers and
+// consumers only ever contend on one CAS of head or tail.
+
+#ifndef RPS_BO9_MATCHQ_H
+#define RPS_BO9_MATCHQ_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mailbox.h"
+#include "server.h"
+
+typedef struct {
+    client_ref_t ref;
+    uint32_t ticket; // valid while the owner's queue state still holds it
+    char nick[NICK_MAX+1];
+} match_entry_t;
+
+typedef struct {
+    atomic_size_t seq; // == position: free for that push; == position + 1: full for that pop
+    match_entry_t e;
+} matchq_cell_t;
+
+typedef struct {
+    _Alignas(CACHELINE) atomic_size_t head;
+    _Alignas(CACHELINE) atomic_size_t tail;
+    _Alignas(CACHELINE) matchq_cell_t *cells;
+    size_t mask;
+} matchq_t;
+
+/* cap is rounded up to a power of two; 0 on success */
+static inline int matchq_init(matchq_t *q, size_t cap) {
+    size_t n = 2;
+    while (n < cap) n <<= 1;
+    q->cells = malloc(n * sizeof(*q->cells));
+    if (!q->cells) return -1;
+    for (size_t i=0;i<n;i++) atomic_init(&q->cells[i].seq, i);
+    q->mask = n - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return 0;
+}
+
+/* 0 on success, -1 if the ring is full */
+static inline int matchq_push(matchq_t *q, const match_entry_t *e) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    matchq_cell_t *cell;
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    cell->e = *e;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+/* 0 on success, -1 if the ring is empty */
+static inline int matchq_pop(matchq_t *q, match_entry_t *out) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    matchq_cell_t *cell;
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+    *out = cell->e;
+    atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+    return 0;
+}
+
+#endif //RPS_BO9_MATCHQ_H
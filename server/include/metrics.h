@@ -0,0 +1,111 @@
+// metrics.h
+// Always-on counters and latency histograms. Every reactor writes only its
+// own cache-line aligned shard, with relaxed load+store instead of atomic
+// read-modify-write, so recording is a few plain instructions. The admin
+// thread sums the shards when scraped (Prometheus text, see metrics_serve).
+//
+// Histograms are log-linear in nanoseconds like HDR histograms: every
+// power of two is split into METRICS_SUB_BUCKETS, so a bucket is at most
+// 25% wide at any magnitude.
+
+#ifndef RPS_BO9_METRICS_H
+#define RPS_BO9_METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "server.h"
+
+#define METRICS_SUB_BITS 2
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BIT 35 // values from 2^36 ns (~69 s) up share the last bucket
+#define METRICS_BUCKETS ((METRICS_MAX_BIT - METRICS_SUB_BITS + 2) * METRICS_SUB_BUCKETS)
+#define METRICS_MAX_CMDS 24
+
+typedef enum {
+    MET_ACCEPTED,       // connections that got a client slot
+    MET_REJECTED,       // turned away with SERVER_FULL
+    MET_SHED,           // closed unread while out of fds
+    MET_CLOSED,
+    MET_BYTES_IN,
+    MET_LINES_OUT,
+    MET_OVERLONG,
+    MET_ROOMS_CREATED,
+    MET_ROOMS_RELEASED,
+    MET_SUSPENDED,      // sessions kept for RECONNECT
+    MET_RESUMED,
+    MET_ADOPTED,        // connections taken over at a hot restart
+    MET_ROOMS_ADOPTED,
+    MET_LOSSY_DROPPED,  // lines a lagging recipient missed (client_send_lossy)
+    MET_PAUSED,         // times a client's input was paused for its output to drain
+    MET_EVICTED,        // closed for not draining its output
+    MET_ABUSE,          // closed for too many commands or malformed lines
+    MET_REDIRECTS,      // JOIN/WATCH/RECONNECT sent to another cluster node
+    MET_COUNTERS
+} metric_counter_t;
+
+/* timed operations; command i of metrics_init's table is MET_OP_CMD + i */
+typedef enum { MET_OP_ACCEPT, MET_OP_SEND, MET_OP_CMD, MET_OPS = MET_OP_CMD + METRICS_MAX_CMDS } metric_op_t;
+
+typedef struct {
+    _Atomic uint64_t count, sum_ns;
+    _Atomic uint64_t buckets[METRICS_BUCKETS];
+} metrics_hist_t;
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t counters[MET_COUNTERS];
+    metrics_hist_t ops[MET_OPS];
+} metrics_shard_t;
+
+/* the calling reactor's shard; NULL on threads that record nothing */
+extern __thread metrics_shard_t *metrics_self;
+
+/* names for MET_OP_CMD + i, at most METRICS_MAX_CMDS; NULL entries are not exported */
+void metrics_init(const char *const *cmd_names, int ncmds);
+
+/* bind the calling thread to shard idx (one per reactor) */
+void metrics_attach(int idx);
+
+/* serve /metrics on 127.0.0.1:port from a thread of its own */
+void metrics_serve(int port);
+
+/* only the owning thread writes a shard; readers may see a slightly old value */
+static inline void metrics_bump(_Atomic uint64_t *p, uint64_t n) {
+    atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void metrics_add(metric_counter_t m, uint64_t n) {
+    if (metrics_self) metrics_bump(&metrics_self->counters[m], n);
+}
+
+static inline uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); // vDSO, no syscall
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline int metrics_bucket(uint64_t ns) {
+    if (ns < METRICS_SUB_BUCKETS) return (int)ns;
+    int bit = 63 - __builtin_clzll(ns);
+    if (bit > METRICS_MAX_BIT) return METRICS_BUCKETS - 1;
+    return (bit - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS + (int)((ns >> (bit - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+/* exclusive upper bound of bucket i in ns */
+static inline uint64_t metrics_bucket_upper(int i) {
+    if (i < METRICS_SUB_BUCKETS) return (uint64_t)i + 1;
+    int bit = i / METRICS_SUB_BUCKETS + METRICS_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(i % METRICS_SUB_BUCKETS) + METRICS_SUB_BUCKETS + 1;
+    return sub << (bit - METRICS_SUB_BITS);
+}
+
+static inline void metrics_record(int op, uint64_t ns) {
+    if (!metrics_self) return;
+    metrics_hist_t *h = &metrics_self->ops[op];
+    metrics_bump(&h->count, 1);
+    metrics_bump(&h->sum_ns, ns);
+    metrics_bump(&h->buckets[metrics_bucket(ns)], 1);
+}
+
+#endif //RPS_BO9_METRICS_H
@@ -0,0 +1,25 @@
+// net.h
+// Listening sockets, the outgoing links of cluster mode, and every socket
+// option the server sets. Options are
+// applied to the listener only: Linux copies TCP_NODELAY, SO_KEEPALIVE and
+// its TCP_KEEP* settings, and SO_SNDBUF/SO_RCVBUF to accepted sockets, so
+// accepting a connection costs no setsockopt() at all.
+
+#ifndef RPS_BO9_NET_H
+#define RPS_BO9_NET_H
+
+#define DEFAULT_BACKLOG 1024 // capped by net.core.somaxconn
+#define TCP_KEEPALIVE_INTVL_S 10
+#define TCP_KEEPALIVE_CNT 3
+#define ADMIN_BACKLOG 16
+
+/* bound, listening, non-blocking socket on port; exits on failure */
+int net_listen(int port, int reuseport);
+
+/* blocking listener on 127.0.0.1:port for the admin endpoint; exits on failure */
+int net_listen_admin(int port);
+
+/* connected, non-blocking TCP socket to host:port; -1 if that took over timeout_ms or failed */
+int net_connect(const char *host, int port, int timeout_ms);
+
+#endif //RPS_BO9_NET_H
@@ -0,0 +1,58 @@
+// ostree.h
+// Order-statistic treap: an ordered set of intrusive nodes (embedded in
+// room_t) that also answers "the k-th node" and "rank of this node" in
+// O(log n), so a page at any offset costs O(log n + page). Insert and remove
+// never allocate. Not thread-safe: callers serialize every operation.
+
+#ifndef RPS_BO9_OSTREE_H
+#define RPS_BO9_OSTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct ost_node {
+    struct ost_node *left, *right, *parent;
+    uint32_t size; // nodes in this subtree, itself included; 0 when not in a tree
+    uint32_t prio; // heap order, random
+} ost_node_t;
+
+/* total order of the nodes: <0, 0 or >0 like strcmp; 0 only for a node and itself */
+typedef int (*ost_cmp_t)(const ost_node_t *a, const ost_node_t *b);
+
+/* where a search key falls relative to n: <0 if n sorts before it */
+typedef int (*ost_key_cmp_t)(const ost_node_t *n, const void *key);
+
+typedef struct {
+    ost_node_t *root;
+    ost_cmp_t cmp;
+    uint32_t seed; // priority generator
+} ost_t;
+
+void ost_init(ost_t *t, ost_cmp_t cmp);
+
+static inline uint32_t ost_count(const ost_t *t) { return t->root ? t->root->size : 0; }
+
+static inline int ost_linked(const ost_node_t *n) { return n->size != 0; }
+
+/* n must not be in any tree */
+void ost_insert(ost_t *t, ost_node_t *n);
+
+/* n must be in t */
+void ost_remove(ost_t *t, ost_node_t *n);
+
+/* 0-based k-th node in order, NULL if k >= ost_count(t) */
+ost_node_t *ost_at(const ost_t *t, uint32_t k);
+
+/* first node with cmp(n, key) >= 0, NULL if there is none */
+ost_node_t *ost_lower_bound(const ost_t *t, ost_key_cmp_t cmp, const void *key);
+
+/* how many nodes sort before n */
+uint32_t ost_rank(const ost_node_t *n);
+
+/* in-order successor, NULL after the last */
+ost_node_t *ost_next(const ost_node_t *n);
+
+/* the struct a node is embedded in */
+#define ost_entry(n, type, member) ((type *)((char *)(n) - offsetof(type, member)))
+
+#endif //RPS_BO9_OSTREE_H
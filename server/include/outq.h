@@ -0,0 +1,64 @@
+// outq.h
+// Per-connection output queue: a list of segments flushed with one
+// sendmsg() per batch. Small writes are coalesced into owned chunks;
+// large shared buffers (snapshot_t) are queued by reference.
+
+#ifndef RPS_BO9_OUTQ_H
+#define RPS_BO9_OUTQ_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "snapshot.h"
+
+#define OUTQ_CHUNK 4096      // owned chunk size, header included
+#define OUTQ_INLINE_MAX 512  // shared buffers up to this size are copied instead
+#define OUTQ_IOV 64          // segments per sendmsg
+
+typedef struct outseg {
+    struct outseg *next;
+    snapshot_t *shared;  // non-NULL: data points into this shared buffer
+    const char *data;
+    size_t len, off;     // bytes queued / already sent
+    size_t cap;          // owned chunks only
+    char buf[];
+} outseg_t;
+
+typedef struct {
+    outseg_t *head, *tail;
+    size_t bytes;        // queued and not yet sent
+} outq_t;
+
+/* copy len bytes to the tail; 0 on success, -1 on allocation failure */
+int outq_append(outq_t *q, const char *data, size_t len);
+
+/* room for at least n bytes at the tail, made visible by outq_commit */
+char *outq_reserve(outq_t *q, size_t n);
+void outq_commit(outq_t *q, size_t n);
+
+/* queue a shared buffer; takes its own reference */
+int outq_append_shared(outq_t *q, snapshot_t *s);
+
+/* send as much as the socket takes; 0 = ok (maybe pending), -1 = dead */
+int outq_flush(outq_t *q, int fd);
+
+/* the next batch of unsent bytes as up to OUTQ_IOV iovecs, for sending
+ * elsewhere (io_uring); *bytes is their total. Nothing is retired until
+ * outq_consume, so the queue must not be flushed meanwhile. */
+int outq_iov(const outq_t *q, struct iovec *iov, size_t *bytes);
+
+/* retire n sent bytes from the front */
+void outq_consume(outq_t *q, size_t n);
+
+/* drop everything still queued */
+void outq_clear(outq_t *q);
+
+/* copy up to n unsent bytes, starting off bytes past the first unsent one; returns the count */
+size_t outq_peek(const outq_t *q, size_t off, char *dst, size_t n);
+
+/* unsent bytes this queue holds memory for, i.e. not in shared buffers; walks the queue */
+size_t outq_owned(const outq_t *q);
+
+static inline int outq_empty(const outq_t *q) { return q->bytes == 0; }
+
+#endif //RPS_BO9_OUTQ_H
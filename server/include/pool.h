@@ -0,0 +1,44 @@
+// pool.h
+// Fixed-size object pools carved out of cache-line aligned slabs. A pool
+// belongs to one thread (its reactor): get/put are a pointer pop/push on an
+// intrusive free list, and slabs are only ever added, never returned.
+
+#ifndef RPS_BO9_POOL_H
+#define RPS_BO9_POOL_H
+
+#include <stddef.h>
+
+#define POOL_ALIGN 64 // objects start on their own cache line
+#define POOL_GROW 64  // objects per slab once the preallocated ones run out
+
+typedef struct pool_item {
+    struct pool_item *next;
+} pool_item_t;
+
+typedef struct {
+    size_t size;       // object size, rounded up to POOL_ALIGN
+    pool_item_t *free;
+    size_t total;      // objects carved so far
+} pool_t;
+
+/* carve prealloc objects of size bytes up front; 0 on success */
+int pool_init(pool_t *p, size_t size, size_t prealloc);
+
+/* add a slab of n objects; 0 on success, -1 out of memory */
+int pool_grow(pool_t *p, size_t n);
+
+/* uninitialized object, NULL if out of memory */
+static inline void *pool_get(pool_t *p) {
+    if (!p->free && pool_grow(p, POOL_GROW) < 0) return NULL;
+    pool_item_t *it = p->free;
+    p->free = it->next;
+    return it;
+}
+
+static inline void pool_put(pool_t *p, void *obj) {
+    pool_item_t *it = obj;
+    it->next = p->free;
+    p->free = it;
+}
+
+#endif //RPS_BO9_POOL_H
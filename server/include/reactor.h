@@ -0,0 +1,78 @@
+// reactor.h
+// Edge-triggered epoll event loops. Each reactor thread owns its listening
+// socket (SO_REUSEPORT when there are several) and its connections end to
+// end; traffic for a client on another reactor goes through SPSC mailboxes.
+
+#ifndef RPS_BO9_REACTOR_H
+#define RPS_BO9_REACTOR_H
+
+#include "server.h"
+#include "snapshot.h"
+#include "timerwheel.h"
+
+/* set up one reactor per listen fd; nothing runs yet */
+void reactor_init(int nworkers, const int *listen_fds);
+
+/* run the reactors (the caller's thread is reactor 0); does not return.
+ * on_start, if given, runs on every reactor's thread before any of them
+ * handles an event. */
+void reactor_start(void (*on_start)(void));
+
+/* between init and start: take over an open connection on reactor idx, with
+ * len bytes it sent that were not parsed yet. NULL if it cannot be added. */
+client_t *reactor_adopt(int idx, int fd, const char *pending, size_t len);
+
+/* from a thread that is no reactor: make every reactor stop reading sockets
+ * and running timers, and wait until the mail between them has settled, so
+ * clients, rooms and sessions hold still to be read. 0 once they do, -1
+ * (everything running again) if that takes longer than timeout_ms. */
+int reactor_quiesce(int timeout_ms);
+
+/* undo reactor_quiesce */
+void reactor_resume(void);
+
+/* index of the reactor running on the calling thread */
+int reactor_index(void);
+
+/* the same, but -1 on a thread that runs no reactor */
+int reactor_current(void);
+
+int reactor_count(void);
+
+/* run fn(arg) on reactor dst's thread with no locks held. Always deferred to
+ * that reactor's next mailbox drain (the own one included), so it may be
+ * called with a room lock held. */
+void reactor_call(int dst, void (*fn)(uint64_t arg), uint64_t arg);
+
+/* monotonic clock in ms, sampled once per loop iteration */
+uint64_t reactor_now_ms(void);
+
+/* the calling reactor's timer wheel; t fires from its loop, never early */
+void reactor_timer_arm(tw_timer_t *t, uint64_t delay_ms);
+void reactor_timer_cancel(tw_timer_t *t);
+
+/* queue bytes on a local client's write buffer; flushed at the end of the loop iteration */
+int conn_write(client_t *c, const char *data, size_t len);
+
+/* format in place: reserve at least n bytes at the tail of the queue, then commit what was used */
+char *conn_reserve(client_t *c, size_t n);
+void conn_commit(client_t *c, size_t n);
+
+/* queue a shared buffer by reference (small ones are copied) */
+int conn_write_shared(client_t *c, snapshot_t *s);
+
+/* best-effort flush of what is queued, then close (timeouts, kicks) */
+void conn_drop(client_t *c);
+
+/* queue bytes for any client; crosses to the owning reactor's mailbox if needed */
+int client_send(client_ref_t to, const char *data, size_t len);
+
+/* client_send of a shared buffer: the mail carries a reference instead of a
+ * copy. The caller keeps its own reference. */
+int client_send_shared(client_ref_t to, snapshot_t *s);
+
+/* client_send_shared for updates a recipient can do without: dropped, on its
+ * own reactor, if more than max_queued bytes are still waiting for it */
+int client_send_lossy(client_ref_t to, snapshot_t *s, size_t max_queued);
+
+#endif //RPS_BO9_REACTOR_H
@@ -5,4 +5,106 @@
 #ifndef RPS_BO9_SERVER_H
 #define RPS_BO9_SERVER_H
 
-#endif //RPS_BO9_SERVER_H
\ No newline at end of file
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "outq.h"
+#include "timerwheel.h"
+
+#define LINE_BUF 512 // longest accepted line, CRLF included
+#define RECV_BUF 4096
+#define DEFAULT_MAX_CLIENTS 128 // per reactor
+#define DEFAULT_MAX_ROOMS 64
+#define MAX_CLIENTS_LIMIT (1 << 24) // REF_SLOT is 24 bits
+#define MAX_ROOMS_LIMIT (1 << 24)   // leaves at least 7 bits of room id for the generation, 3 in a cluster of 16
+#define MAX_WORKERS 64
+#define NICK_MAX 32
+#define ROOM_NAME_MAX 64
+#define TOKEN_LEN 30
+#define MOVE_TIMEOUT_MS 30000      // a missing move loses the round
+#define KEEPALIVE_MS 60000         // silence before a connection is considered gone
+#define RECONNECT_WINDOW_MS 120000 // a paused game waits this long for the away seat
+#define LOBBY_BATCH_MS TW_TICK_MS  // SUBSCRIBE LOBBY deltas are coalesced over one wheel tick
+#define MATCH_BATCH_MS TW_TICK_MS  // QUEUE pairs players that arrived within one wheel tick
+#define DEFAULT_CMD_RATE 200       // commands per second a connection may sustain
+#define CMD_BURST_S 2              // ... and how many seconds of them it may send at once
+#define INVALID_MAX 10             // malformed lines tolerated per INVALID_WINDOW_MS
+#define INVALID_WINDOW_MS 10000
+#define CMD_RATE_LIMIT 1000000     // keeps ms * cmd_rate well inside 64 bits
+
+typedef enum { ST_CONNECTED, ST_AUTH, ST_IN_LOBBY, ST_IN_ROOM } client_state_t;
+
+/* stable handle to a client on any reactor: gen:32 | reactor:8 | slot:24 */
+typedef uint64_t client_ref_t;
+#define CLIENT_REF_NONE 0
+#define CLIENT_REF(gen, reactor, slot) (((uint64_t)(gen) << 32) | ((uint64_t)(reactor) << 24) | (uint64_t)(slot))
+#define REF_GEN(ref) ((uint32_t)((ref) >> 32))
+#define REF_REACTOR(ref) ((int)(((ref) >> 24) & 0xff))
+#define REF_SLOT(ref) ((int)((ref) & 0xffffff))
+
+typedef struct client {
+    /* hot: everything the event loop touches per event, one cache line */
+    _Alignas(64) int fd;
+    uint8_t dead;         // closed; freed at the end of the loop iteration (2: at its last io_uring completion)
+    uint8_t closing;      // set by QUIT: close once the write buffer drains
+    uint8_t flush_queued; // on the reactor's pending-flush list
+    uint8_t discard;      // dropping the rest of an over-long line
+    uint16_t rhead, rtail; // unparsed bytes are rbuf[rhead..rtail)
+    uint16_t rscan;        // bytes after rhead already searched for '\n'
+    uint8_t binary;        // HELLO ... BIN: frames both ways instead of lines
+    char *rbuf;            // RECV_BUF bytes from the reactor's pool; NULL while nothing is pending
+    struct client *flush_next;
+    uint64_t last_seen_ms; // reactor clock of the last received bytes
+    outq_t out;
+    /* cold: protocol state */
+    client_ref_t ref;
+    client_state_t state;
+    int room_id; // -1 if none
+    char nick[NICK_MAX+1];
+    char token[TOKEN_LEN+1];
+    tw_timer_t idle_timer; // KEEPALIVE; re-armed lazily from last_seen_ms when it fires
+    struct client *dead_next;
+    struct client *sub_prev, *sub_next; // SUBSCRIBE LOBBY list of the owning reactor
+    uint8_t subscribed;
+    uint32_t queue_ticket; // QUEUE entry of this client, 0 if not queued
+    int watch_room;        // WATCH: room spectated, 0 if none; stale once that room closed
+    uint8_t uring_ops;     // io_uring backend: requests still owing a completion
+    uint8_t send_inflight; // io_uring backend: a sendmsg of out is on its way
+    uint8_t recv_armed;    // io_uring backend: the multishot recv is active
+    uint8_t rpaused;       // backpressure: input is left unread until the output drains
+    tw_timer_t drain_timer; // backpressure: evicts a client that stays paused too long
+    uint64_t rate_tat;      // command rate: reactor ms * cmd_rate at which the bucket is full again
+    uint64_t invalid_since_ms; // start of the INVALID_WINDOW_MS that invalid counts in
+    uint8_t invalid;        // malformed lines since invalid_since_ms
+} client_t;
+
+_Static_assert(offsetof(client_t, ref) == 64, "client_t hot fields must fit one cache line");
+_Static_assert(RECV_BUF <= UINT16_MAX, "rhead/rtail are 16 bits");
+
+typedef enum { IO_EPOLL, IO_URING } io_backend_t;
+
+/* startup settings (server.c), fixed before the reactors start */
+typedef struct {
+    int workers;
+    int max_clients; // per reactor
+    int max_rooms;
+    int backlog;
+    int sndbuf, rcvbuf; // 0 = kernel autotuning
+    io_backend_t io;    // how the reactors do socket I/O
+    int cmd_rate;       // commands per second and connection, 0 = unlimited
+} server_config_t;
+
+extern server_config_t config;
+
+/* server.c: protocol callbacks driven by the reactor, always on the owning reactor's thread */
+/* c is zeroed with fd set; -1 rejects it (the reactor closes fd and frees c) */
+int client_open(client_t *c);
+void client_close(client_t *c);
+client_t *client_lookup(client_ref_t ref);
+void handle_line(client_t *c, const char *line, size_t len);
+/* binary client: one frame without its length; NULL for a header no frame follows (c is closed after the reply) */
+void handle_frame(client_t *c, const char *frame, size_t len);
+void handle_overlong_line(client_t *c);
+
+#endif //RPS_BO9_SERVER_H
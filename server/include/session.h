@@ -0,0 +1,41 @@
+// session.h
+// Suspended sessions, keyed by token, kept for RECONNECT_WINDOW after the
+// connection is gone. Open addressing (linear probing) split into shards with
+// one mutex each, so a reconnect storm contends on 16 small locks and never
+// on anything the lobby uses. Entries expire lazily.
+
+#ifndef RPS_BO9_SESSION_H
+#define RPS_BO9_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server.h"
+
+#define SESSION_SHARDS 16   // power of two
+#define SESSION_MIN_SLOTS 64 // per shard; sized by session_init, kept at most 3/4 full
+
+typedef struct {
+    char token[TOKEN_LEN+1]; // "" = free slot
+    char nick[NICK_MAX+1];
+    int room_id;             // room holding the seat, 0 if the session was in the lobby
+    int seat;
+    uint64_t expires_ms;     // reactor clock
+    uint64_t hash;
+} session_t;
+
+/* size the shards for max_sessions live entries; 0 on success */
+int session_init(size_t max_sessions);
+
+/* store a suspended session (hash is filled in); expired entries are reused.
+ * -1 if its shard is full of live ones */
+int session_put(session_t *s, uint64_t now_ms);
+
+/* find a live session by token and remove it; 0 and *out filled, -1 if unknown or expired */
+int session_take(const char *token, size_t len, uint64_t now_ms, session_t *out);
+
+/* call fn on every live session, one shard locked at a time; stops at the
+ * first nonzero return and passes it on */
+int session_foreach(uint64_t now_ms, int (*fn)(const session_t *s, void *arg), void *arg);
+
+#endif //RPS_BO9_SESSION_H
@@ -0,0 +1,45 @@
+// snapshot.h
+// Immutable, reference-counted byte buffers published through an atomic
+// pointer. Readers take a reference without locking (one hazard slot per
+// reactor protects the load/incref window); writers swap in a new buffer
+// and the old one is released once no reader can still be grabbing it.
+
+#ifndef RPS_BO9_SNAPSHOT_H
+#define RPS_BO9_SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct snapshot {
+    atomic_uint refs;
+    uint64_t version;
+    size_t len;
+    char data[];
+} snapshot_t;
+
+typedef struct {
+    _Atomic(snapshot_t *) cur;
+    snapshot_t *retired[8]; // writer side only, waiting for hazards to clear
+    int nretired;
+} snapshot_slot_t;
+
+/* new buffer with one reference (the caller's) and room for cap bytes */
+snapshot_t *snapshot_alloc(size_t cap);
+
+/* take a reference to the current snapshot, NULL if none; reactor threads only */
+snapshot_t *snapshot_acquire(snapshot_slot_t *slot);
+
+/* another reference to a buffer the caller already holds one of */
+static inline snapshot_t *snapshot_get(snapshot_t *s) {
+    atomic_fetch_add_explicit(&s->refs, 1, memory_order_relaxed);
+    return s;
+}
+
+/* drop a reference; frees on the last one. NULL is ignored */
+void snapshot_put(snapshot_t *s);
+
+/* install s (its reference moves to the slot); writers must be serialized */
+void snapshot_publish(snapshot_slot_t *slot, snapshot_t *s);
+
+#endif //RPS_BO9_SNAPSHOT_H
@@ -0,0 +1,48 @@
+// timerwheel.h
+// Hierarchical timing wheel, one per reactor. Timer nodes are intrusive
+// (embedded in client_t / room_t); arm, re-arm and cancel are O(1) and
+// never allocate. Not thread-safe: only the owning reactor touches it.
+
+#ifndef RPS_BO9_TIMERWHEEL_H
+#define RPS_BO9_TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_TICK_MS 100
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 4 // 64^4 ticks of 100 ms, about 19 days
+
+typedef struct tw_timer {
+    struct tw_timer *prev, *next; // NULL when not armed
+    uint64_t expires;             // absolute tick
+    void (*cb)(struct tw_timer *t);
+} tw_timer_t;
+
+typedef struct {
+    uint64_t now;      // current tick
+    uint64_t start_ms; // clock value of tick 0
+    size_t count;      // armed timers
+    tw_timer_t slots[TW_LEVELS][TW_SLOTS]; // list heads
+} timer_wheel_t;
+
+void tw_init(timer_wheel_t *tw, uint64_t now_ms);
+
+/* (re)arm t to fire delay_ms from the wheel's current tick */
+void tw_arm(timer_wheel_t *tw, tw_timer_t *t, uint64_t delay_ms);
+
+void tw_cancel(timer_wheel_t *tw, tw_timer_t *t);
+
+static inline int tw_armed(const tw_timer_t *t) { return t->next != NULL; }
+
+/* the struct a timer node is embedded in */
+#define tw_entry(t, type, member) ((type *)((char *)(t) - offsetof(type, member)))
+
+/* run every timer due by now_ms; callbacks may re-arm or cancel timers */
+void tw_advance(timer_wheel_t *tw, uint64_t now_ms);
+
+/* epoll_wait timeout: -1 with no timers, else ms until the next tick */
+int tw_timeout_ms(const timer_wheel_t *tw, uint64_t now_ms);
+
+#endif //RPS_BO9_TIMERWHEEL_H
@@ -0,0 +1,15 @@
+// token.h
+// Session tokens: TOKEN_LEN hex digits from a per-thread pool of kernel
+// randomness (getrandom, refilled in batches), hex-encoded 16 bytes at a time.
+
+#ifndef RPS_BO9_TOKEN_H
+#define RPS_BO9_TOKEN_H
+
+#include "server.h"
+
+#define TOKEN_POOL 4096 // random bytes fetched per getrandom() call
+
+/* write TOKEN_LEN hex digits and a NUL to out (TOKEN_LEN+1 bytes) */
+void token_generate(char *out);
+
+#endif //RPS_BO9_TOKEN_H
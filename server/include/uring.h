@@ -0,0 +1,80 @@
+// uring.h
+// Minimal io_uring plumbing on the raw syscalls (no liburing): one ring
+// per reactor thread, SQEs handed out zeroed, completions read straight
+// off the mapped CQ ring, and a provided-buffer ring for multishot recv.
+// A ring belongs to the thread that created it (IORING_SETUP_SINGLE_ISSUER).
+
+#ifndef RPS_BO9_URING_H
+#define RPS_BO9_URING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+    unsigned sq_local;  // SQEs handed out, published to the kernel on submit
+    unsigned sq_pending; // published, not submitted yet
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+} uring_t;
+
+/* provided buffers of one group: count buffers of size bytes */
+typedef struct {
+    struct io_uring_buf_ring *ring;
+    char *base;
+    unsigned mask, size;
+    uint16_t tail;  // local; published by uring_bufs_commit
+    uint16_t group;
+} uring_bufs_t;
+
+/* 1 if this kernel has everything the io_uring backend uses */
+int uring_supported(void);
+
+/* setup on the calling thread; 0 or -errno */
+int uring_init(uring_t *u, unsigned entries);
+
+/* a zeroed SQE; submits what is queued first if the SQ is full. NULL only if that fails */
+struct io_uring_sqe *uring_sqe(uring_t *u);
+
+/* submit what is queued and wait up to timeout_ms (-1: forever, 0: not at
+ * all) for a completion; 0, or -errno (-ETIME on timeout, -EINTR) */
+int uring_wait(uring_t *u, int timeout_ms);
+
+/* next completion, NULL when none; copy it before uring_cqe_seen() */
+static inline struct io_uring_cqe *uring_cqe(uring_t *u) {
+    unsigned head = *u->cq_head;
+    if (head == atomic_load_explicit((_Atomic unsigned *)u->cq_tail, memory_order_acquire)) return NULL;
+    return &u->cqes[head & u->cq_mask];
+}
+
+static inline void uring_cqe_seen(uring_t *u) {
+    atomic_store_explicit((_Atomic unsigned *)u->cq_head, *u->cq_head + 1, memory_order_release);
+}
+
+/* register group group with count (power of two) buffers of size bytes; 0 or -errno */
+int uring_bufs_init(uring_t *u, uring_bufs_t *b, uint16_t group, unsigned count, unsigned size);
+
+static inline char *uring_buf(const uring_bufs_t *b, unsigned bid) {
+    return b->base + (size_t)bid * b->size;
+}
+
+/* hand buffer bid back; the kernel sees it after uring_bufs_commit() */
+static inline void uring_buf_put(uring_bufs_t *b, unsigned bid) {
+    struct io_uring_buf *e = &b->ring->bufs[b->tail & b->mask];
+    e->addr = (uint64_t)(uintptr_t)uring_buf(b, bid);
+    e->len = b->size;
+    e->bid = (uint16_t)bid;
+    b->tail++;
+}
+
+static inline void uring_bufs_commit(uring_bufs_t *b) {
+    atomic_store_explicit((_Atomic uint16_t *)&b->ring->tail, b->tail, memory_order_release);
+}
+
+#endif //RPS_BO9_URING_H
@@ -0,0 +1,368 @@
+// cluster.c
+// Peer links and the mirror of remote rooms (see cluster.h). One thread
+// holds a connection to every other node's public port, speaking the
+// client protocol: HELLO, SUBSCRIBE LOBBY, a PING now and then. The
+// subscription baseline and its deltas keep the mirror current; a line about
+// a room the sending node does not own (one of ours, or a third node's it
+// mirrors) is ignored, so nothing is counted twice or echoed back. A link
+// that drops takes that node's rooms with it until it is back.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "cluster.h"
+#include "log.h"
+#include "net.h"
+#include "ostree.h"
+#include "server.h"
+
+#define LINK_ARGS 6
+
+typedef struct {
+    ost_node_t by_id;
+    int id;
+    int players;
+    char name[ROOM_NAME_MAX+1];
+    char state[16];
+    uint8_t stale; // not in the baseline being received
+} remote_room_t;
+
+typedef struct {
+    int fd;                // -1 while down
+    int baseline;          // ROOM lines of the ROOM_LIST still to come, -1 outside of one
+    uint64_t retry_ms, ping_ms;
+    size_t len;
+    char buf[RECV_BUF];
+} peer_t;
+
+int cluster_nodes;
+int cluster_self;
+int cluster_node_bits;
+
+static cluster_node_t nodes[CLUSTER_MAX_NODES];
+static peer_t peers[CLUSTER_MAX_NODES]; // link thread only
+
+static pthread_mutex_t mirror_lock = PTHREAD_MUTEX_INITIALIZER; // rooms and deltas; a leaf lock
+static ost_t rooms;
+static struct { char *p; size_t len, cap; } deltas;
+static void (*changed)(void);
+
+static uint64_t mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int by_id_cmp(const ost_node_t *a, const ost_node_t *b) {
+    int x = ost_entry(a, remote_room_t, by_id)->id, y = ost_entry(b, remote_room_t, by_id)->id;
+    return (x > y) - (x < y);
+}
+
+static int id_key_cmp(const ost_node_t *n, const void *key) {
+    int x = ost_entry(n, remote_room_t, by_id)->id, y = *(const int *)key;
+    return (x > y) - (x < y);
+}
+
+int cluster_parse(const char *list, int self) {
+    int n = 0;
+    const char *s = list;
+    while (*s) {
+        if (n == CLUSTER_MAX_NODES) return -1;
+        const char *end = strchr(s, ',');
+        if (!end) end = s + strlen(s);
+        const char *colon = memrchr(s, ':', (size_t)(end - s));
+        if (!colon || colon == s || (size_t)(colon - s) > CLUSTER_HOST_MAX) return -1;
+        memcpy(nodes[n].host, s, (size_t)(colon - s));
+        nodes[n].host[colon - s] = '\0';
+        char *stop;
+        long port = strtol(colon + 1, &stop, 10);
+        if (stop != end || colon + 1 == end || port < 1 || port > 65535) return -1;
+        nodes[n++].port = (int)port;
+        s = *end ? end + 1 : end;
+    }
+    if (n == 0 || self < 0 || self >= n) return -1;
+    cluster_nodes = n;
+    cluster_self = self;
+    while ((1 << cluster_node_bits) < n) cluster_node_bits++;
+    return 0;
+}
+
+const cluster_node_t *cluster_node(int i) {
+    return &nodes[i];
+}
+
+void cluster_mark_token(char *token) {
+    if (cluster_nodes) token[0] = "0123456789abcdef"[cluster_self];
+}
+
+int cluster_token_node(const char *token) {
+    if (!cluster_nodes) return -1;
+    char ch = token[0];
+    int i = ch >= '0' && ch <= '9' ? ch - '0' : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10 : -1;
+    return i < cluster_nodes ? i : -1;
+}
+
+static remote_room_t *room_find(int id) {
+    ost_node_t *n = ost_lower_bound(&rooms, id_key_cmp, &id);
+    remote_room_t *r = n ? ost_entry(n, remote_room_t, by_id) : NULL;
+    return r && r->id == id ? r : NULL;
+}
+
+/* queue a line (CRLF added) for local subscribers; mirror_lock held */
+static void delta_add(const char *line, size_t n) {
+    if (deltas.cap - deltas.len < n + 2) {
+        size_t cap = deltas.cap ? deltas.cap * 2 : 16384;
+        while (cap - deltas.len < n + 2) cap *= 2;
+        char *p = realloc(deltas.p, cap);
+        if (!p) return; // subscribers miss it; LIST still has it
+        deltas.p = p;
+        deltas.cap = cap;
+    }
+    memcpy(deltas.p + deltas.len, line, n);
+    memcpy(deltas.p + deltas.len + n, "\r\n", 2);
+    deltas.len += n + 2;
+}
+
+static void delta_removed(int id) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "ROOM_REMOVED %d", id);
+    delta_add(line, (size_t)n);
+}
+
+/* mirror_lock held */
+static void room_drop(remote_room_t *r) {
+    delta_removed(r->id);
+    ost_remove(&rooms, &r->by_id);
+    free(r);
+}
+
+/* rooms of node i flagged stale (or all of them) go; mirror_lock held */
+static int drop_rooms(int i, int only_stale) {
+    int dropped = 0;
+    ost_node_t *n = ost_at(&rooms, 0);
+    while (n) {
+        remote_room_t *r = ost_entry(n, remote_room_t, by_id);
+        n = ost_next(n);
+        if (cluster_room_node(r->id) != i || (only_stale && !r->stale)) continue;
+        room_drop(r);
+        dropped++;
+    }
+    return dropped;
+}
+
+/* "p/2" */
+static int players_arg(const char *s) {
+    return s[0] >= '0' && s[0] <= '2' && s[1] == '/' ? s[0] - '0' : -1;
+}
+
+/* ROOM or ROOM_ADDED: id name p/2 state; mirror_lock held */
+static int room_upsert(int i, char **arg) {
+    int id = atoi(arg[1]);
+    int players = players_arg(arg[3]);
+    if (id <= 0 || cluster_room_node(id) != i || players < 0 ||
+        strlen(arg[2]) > ROOM_NAME_MAX || strlen(arg[4]) >= sizeof(((remote_room_t *)0)->state)) return 0;
+    char line[ROOM_NAME_MAX + 64];
+    int n;
+    remote_room_t *r = room_find(id);
+    if (!r) {
+        if (ost_count(&rooms) >= CLUSTER_ROOMS_MAX || !(r = calloc(1, sizeof(*r)))) return 0;
+        r->id = id;
+        strcpy(r->name, arg[2]);
+        ost_insert(&rooms, &r->by_id);
+        n = snprintf(line, sizeof(line), "ROOM_ADDED %d %s %d/2 %s", id, r->name, players, arg[4]);
+    } else {
+        r->stale = 0;
+        if (r->players == players && strcmp(r->state, arg[4]) == 0) return 0; // a baseline repeating what we have
+        n = snprintf(line, sizeof(line), "ROOM_UPDATED %d %d/2 %s", id, players, arg[4]);
+    }
+    strcpy(r->state, arg[4]);
+    r->players = players;
+    delta_add(line, (size_t)n);
+    return 1;
+}
+
+/* one line from node i, CRLF stripped; returns whether the mirror changed */
+static int peer_line(int i, char *line) {
+    char *arg[LINK_ARGS];
+    int argc = 0;
+    for (char *save, *t = strtok_r(line, " ", &save); t && argc < LINK_ARGS; t = strtok_r(NULL, " ", &save))
+        arg[argc++] = t;
+    if (argc == 0) return 0;
+    peer_t *p = &peers[i];
+    int change = 0;
+    pthread_mutex_lock(&mirror_lock);
+    if (strcmp(arg[0], "ROOM_LIST") == 0 && argc == 2 && p->baseline < 0) {
+        /* the baseline of the subscription; whatever it leaves out is gone */
+        for (ost_node_t *n = ost_at(&rooms, 0); n; n = ost_next(n)) {
+            remote_room_t *r = ost_entry(n, remote_room_t, by_id);
+            if (cluster_room_node(r->id) == i) r->stale = 1;
+        }
+        p->baseline = atoi(arg[1]);
+        if (p->baseline <= 0) {
+            p->baseline = -1;
+            change = drop_rooms(i, 1);
+        }
+    } else if (strcmp(arg[0], "ROOM") == 0 && argc == 5 && p->baseline > 0) {
+        change = room_upsert(i, arg);
+        if (--p->baseline == 0) {
+            p->baseline = -1;
+            change |= drop_rooms(i, 1);
+        }
+    } else if (strcmp(arg[0], "ROOM_ADDED") == 0 && argc == 5) {
+        change = room_upsert(i, arg);
+    } else if (strcmp(arg[0], "ROOM_UPDATED") == 0 && argc == 4) {
+        int id = atoi(arg[1]);
+        int players = players_arg(arg[2]);
+        remote_room_t *r = cluster_room_node(id) == i ? room_find(id) : NULL;
+        if (r && players >= 0 && strlen(arg[3]) < sizeof(r->state)) {
+            r->players = players;
+            strcpy(r->state, arg[3]);
+            char out[64];
+            int n = snprintf(out, sizeof(out), "ROOM_UPDATED %d %d/2 %s", id, players, r->state);
+            delta_add(out, (size_t)n);
+            change = 1;
+        }
+    } else if (strcmp(arg[0], "ROOM_REMOVED") == 0 && argc == 2) {
+        int id = atoi(arg[1]);
+        remote_room_t *r = cluster_room_node(id) == i ? room_find(id) : NULL;
+        if (r) {
+            room_drop(r);
+            change = 1;
+        }
+    }
+    pthread_mutex_unlock(&mirror_lock);
+    return change;
+}
+
+static int peer_send(peer_t *p, const char *s) {
+    size_t n = strlen(s);
+    return send(p->fd, s, n, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)n ? 0 : -1;
+}
+
+static void peer_down(int i, const char *why) {
+    peer_t *p = &peers[i];
+    close(p->fd);
+    p->fd = -1;
+    p->len = 0;
+    p->baseline = -1;
+    p->retry_ms = mono_ms() + CLUSTER_RETRY_MS;
+    LOG(LOG_WARN, "peer_down", " node=%d addr=%s:%d why=%s", i, nodes[i].host, nodes[i].port, why);
+    pthread_mutex_lock(&mirror_lock);
+    int dropped = drop_rooms(i, 0);
+    pthread_mutex_unlock(&mirror_lock);
+    if (dropped) changed();
+}
+
+static void peer_connect(int i) {
+    peer_t *p = &peers[i];
+    p->fd = net_connect(nodes[i].host, nodes[i].port, CLUSTER_CONNECT_TIMEOUT_MS);
+    if (p->fd < 0) {
+        p->retry_ms = mono_ms() + CLUSTER_RETRY_MS; // quietly: the peer may not be up yet
+        return;
+    }
+    char hello[64];
+    snprintf(hello, sizeof(hello), "HELLO node%d\r\nSUBSCRIBE LOBBY\r\n", cluster_self);
+    if (peer_send(p, hello) < 0) { peer_down(i, "send"); return; }
+    p->ping_ms = mono_ms() + CLUSTER_PING_MS;
+    LOG(LOG_INFO, "peer_up", " node=%d addr=%s:%d", i, nodes[i].host, nodes[i].port);
+}
+
+/* a readable link: take its whole lines */
+static void peer_read(int i) {
+    peer_t *p = &peers[i];
+    ssize_t n = recv(p->fd, p->buf + p->len, sizeof(p->buf) - p->len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) { peer_down(i, n == 0 ? "eof" : strerrorname_np(errno)); return; }
+    p->len += (size_t)n;
+    int change = 0;
+    char *s = p->buf, *end = p->buf + p->len, *nl;
+    while ((nl = memchr(s, '\n', (size_t)(end - s))) != NULL) {
+        *nl = '\0';
+        if (nl > s && nl[-1] == '\r') nl[-1] = '\0';
+        change |= peer_line(i, s);
+        s = nl + 1;
+    }
+    p->len = (size_t)(end - s);
+    memmove(p->buf, s, p->len);
+    if (change) changed();
+    if (p->len == sizeof(p->buf)) peer_down(i, "line_too_long");
+}
+
+static void *link_main(void *arg) {
+    (void)arg;
+    struct pollfd pfd[CLUSTER_MAX_NODES];
+    int idx[CLUSTER_MAX_NODES];
+    for (;;) {
+        uint64_t now = mono_ms();
+        int n = 0;
+        for (int i=0;i<cluster_nodes;i++) {
+            if (i == cluster_self) continue;
+            peer_t *p = &peers[i];
+            if (p->fd < 0 && now >= p->retry_ms) peer_connect(i);
+            if (p->fd >= 0 && now >= p->ping_ms) {
+                p->ping_ms = now + CLUSTER_PING_MS;
+                if (peer_send(p, "PING\r\n") < 0) peer_down(i, "send");
+            }
+            if (p->fd < 0) continue;
+            pfd[n] = (struct pollfd){ p->fd, POLLIN, 0 };
+            idx[n++] = i;
+        }
+        if (poll(pfd, (nfds_t)n, 1000) <= 0) continue;
+        for (int k=0;k<n;k++)
+            if (pfd[k].revents) peer_read(idx[k]);
+    }
+    return NULL;
+}
+
+void cluster_start(void (*on_change)(void)) {
+    if (cluster_nodes < 2) return;
+    changed = on_change;
+    ost_init(&rooms, by_id_cmp);
+    for (int i=0;i<cluster_nodes;i++) peers[i] = (peer_t){ .fd = -1, .baseline = -1 };
+    pthread_t t;
+    if (pthread_create(&t, NULL, link_main, NULL) != 0) { perror("pthread_create"); exit(1); }
+    pthread_detach(t);
+}
+
+int cluster_format_rooms(char **body, size_t *len, size_t *cap) {
+    if (cluster_nodes < 2) return 0;
+    int count = 0;
+    pthread_mutex_lock(&mirror_lock);
+    for (ost_node_t *n = ost_at(&rooms, 0); n; n = ost_next(n)) {
+        remote_room_t *r = ost_entry(n, remote_room_t, by_id);
+        if (*cap - *len < ROOM_NAME_MAX + 64) {
+            size_t c = *cap ? *cap * 2 : 16384;
+            char *nb = realloc(*body, c);
+            if (!nb) break;
+            *body = nb;
+            *cap = c;
+        }
+        *len += (size_t)snprintf(*body + *len, *cap - *len, "ROOM %d %s %d/2 %s\r\n", r->id, r->name, r->players, r->state);
+        count++;
+    }
+    pthread_mutex_unlock(&mirror_lock);
+    return count;
+}
+
+size_t cluster_take_deltas(char **buf, size_t *cap) {
+    if (cluster_nodes < 2) return 0;
+    pthread_mutex_lock(&mirror_lock);
+    size_t len = deltas.len;
+    char *p = deltas.p;
+    size_t c = deltas.cap;
+    deltas.p = *buf;
+    deltas.cap = *cap;
+    deltas.len = 0;
+    *buf = p;
+    *cap = c;
+    pthread_mutex_unlock(&mirror_lock);
+    return len;
+}
@@ -0,0 +1,109 @@
+// codec.c
+// Text line <-> binary frame conversion (see codec.h and docs/protocol.md).
+// Opcodes are part of the protocol: never renumber, only append.
+
+#include <string.h>
+
+#include "codec.h"
+
+static const char *const words[] = {
+    /* client -> server */
+    [0x01] = "HELLO", [0x02] = "LIST", [0x03] = "CREATE", [0x04] = "JOIN", [0x05] = "LEAVE",
+    [0x06] = "READY", [0x07] = "MOVE", [0x08] = "QUIT", [0x09] = "PING", [0x0a] = "RECONNECT",
+    [0x0b] = "SUBSCRIBE", [0x0c] = "UNSUBSCRIBE", [0x0d] = "QUEUE", [0x0e] = "UNQUEUE",
+    [0x0f] = "WATCH", [0x10] = "UNWATCH",
+    /* server -> client */
+    [0x40] = "WELCOME", [0x41] = "ERR", [0x42] = "OK", [0x43] = "ROOM_LIST", [0x44] = "ROOM",
+    [0x45] = "ROOM_CREATED", [0x46] = "ROOM_JOINED", [0x47] = "PLAYER_JOINED", [0x48] = "PLAYER_LEFT",
+    [0x49] = "GAME_START", [0x4a] = "ROUND_START", [0x4b] = "MOVE_ACCEPTED", [0x4c] = "ROUND_RESULT",
+    [0x4d] = "GAME_END", [0x4e] = "PONG", [0x4f] = "ROOM_ADDED", [0x50] = "ROOM_UPDATED",
+    [0x51] = "ROOM_REMOVED", [0x52] = "RECONNECT_OK", [0x53] = "WATCHING", [0x54] = "WATCH_END",
+    [0x55] = "PLAYER_UNAVAILABLE", [0x56] = "KICKED", [0x57] = "LEFT",
+    [0x58] = "REDIRECT",
+};
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+const char *codec_word(uint8_t op) {
+    return op < NWORDS ? words[op] : NULL;
+}
+
+static uint8_t word_op(const char *w, size_t n) {
+    for (size_t op=1;op<NWORDS;op++)
+        if (words[op] && words[op][0] == w[0] && strncmp(words[op], w, n) == 0 && words[op][n] == '\0') return (uint8_t)op;
+    return CODEC_OP_WORD;
+}
+
+int codec_frame(const uint8_t *p, size_t avail, size_t *hdr, size_t *len) {
+    uint64_t v;
+    size_t h = codec_varint(p, avail, 2, &v);
+    if (h == 0) return avail < 2 && (avail == 0 || (p[0] & 0x80)) ? 0 : -1;
+    if (v == 0 || v > CODEC_FRAME_MAX) return -1;
+    *hdr = h;
+    *len = (size_t)v;
+    return 1;
+}
+
+int codec_field(const uint8_t **p, const uint8_t *end, codec_field_t *f) {
+    if (*p == end) return 0;
+    uint64_t tag;
+    size_t h = codec_varint(*p, (size_t)(end - *p), 10, &tag);
+    if (h == 0) return -1;
+    *p += h;
+    f->is_num = !(tag & 1);
+    if (f->is_num) {
+        f->num = tag >> 1;
+        return 1;
+    }
+    f->n = (size_t)(tag >> 1);
+    if (f->n > (size_t)(end - *p)) return -1;
+    f->p = (const char *)*p;
+    *p += f->n;
+    return 1;
+}
+
+/* a decimal that a number field gives back as is: no sign, no leading zero, fits 63 bits */
+static int is_num(const char *s, size_t n, uint64_t *v) {
+    if (n == 0 || n > 18 || (s[0] == '0' && n > 1)) return 0;
+    uint64_t x = 0;
+    for (size_t i=0;i<n;i++) {
+        if (s[i] < '0' || s[i] > '9') return 0;
+        x = x*10 + (uint64_t)(s[i] - '0');
+    }
+    *v = x;
+    return 1;
+}
+
+static size_t put_str(uint8_t *p, const char *s, size_t n) {
+    size_t h = codec_put_varint(p, (uint64_t)n << 1 | 1);
+    memcpy(p + h, s, n);
+    return h + n;
+}
+
+size_t codec_encode_line(const char *line, size_t len, uint8_t *dst) {
+    uint8_t body[CODEC_LINE_OUT];
+    if (len > CODEC_LINE_OUT - 32) len = CODEC_LINE_OUT - 32; // server lines are at most LINE_BUF
+    const char *s = line, *end = line + len;
+    size_t n = 0;
+    int first = 1;
+    while (s < end) {
+        while (s < end && *s == ' ') s++;
+        if (s == end) break;
+        const char *t = memchr(s, ' ', (size_t)(end - s));
+        if (!t) t = end;
+        size_t k = (size_t)(t - s);
+        uint64_t v;
+        if (first) {
+            body[n++] = word_op(s, k);
+            if (body[0] == CODEC_OP_WORD) n += put_str(body + n, s, k);
+            first = 0;
+        } else if (is_num(s, k, &v)) {
+            n += codec_put_varint(body + n, v << 1);
+        } else {
+            n += put_str(body + n, s, k);
+        }
+        s = t;
+    }
+    size_t h = codec_put_varint(dst, n);
+    memcpy(dst + h, body, n);
+    return h + n;
+}
@@ -0,0 +1,91 @@
+// game.c
+// bo9 round engine.
+
+#include <string.h>
+
+#include "game.h"
+
+/* winner[move_seat0][move_seat1]; MOVE_NONE (timed out) loses to any move */
+static const uint8_t winner[4][4] = {
+    /*            NONE         R            P            S       */
+    /* NONE */ { ROUND_DRAW,  ROUND_SEAT1, ROUND_SEAT1, ROUND_SEAT1 },
+    /* R    */ { ROUND_SEAT0, ROUND_DRAW,  ROUND_SEAT1, ROUND_SEAT0 },
+    /* P    */ { ROUND_SEAT0, ROUND_SEAT0, ROUND_DRAW,  ROUND_SEAT1 },
+    /* S    */ { ROUND_SEAT0, ROUND_SEAT1, ROUND_SEAT0, ROUND_DRAW  },
+};
+
+static const uint8_t move_of[256] = {
+    ['R'] = MOVE_R, ['P'] = MOVE_P, ['S'] = MOVE_S,
+    ['r'] = MOVE_R, ['p'] = MOVE_P, ['s'] = MOVE_S,
+};
+
+void game_reset(game_t *g) {
+    memset(g, 0, sizeof(*g));
+    g->state = ROOM_OPEN;
+}
+
+void game_seated(game_t *g, int players) {
+    if (g->state == ROOM_OPEN || g->state == ROOM_WAITING) g->state = players == 2 ? ROOM_WAITING : ROOM_OPEN;
+}
+
+int game_ready(game_t *g, int seat) {
+    if (g->state != ROOM_OPEN && g->state != ROOM_WAITING) return -1;
+    g->flags |= (uint8_t)GAME_READY(seat);
+    if (g->state != ROOM_WAITING || (g->flags & (GAME_READY(0) | GAME_READY(1))) != 3) return 0;
+    g->state = ROOM_PLAYING;
+    g->round = 1;
+    g->score[0] = g->score[1] = 0;
+    g->move[0] = g->move[1] = MOVE_NONE;
+    return 1;
+}
+
+int game_move(game_t *g, int seat, move_t m) {
+    if (g->state != ROOM_PLAYING || g->move[seat] != MOVE_NONE || m == MOVE_NONE) return -1;
+    g->move[seat] = (uint8_t)m;
+    return g->move[1-seat] != MOVE_NONE;
+}
+
+round_winner_t game_resolve(game_t *g) {
+    round_winner_t w = winner[g->move[0] & 3][g->move[1] & 3];
+    g->score[0] += (w == ROUND_SEAT0);
+    g->score[1] += (w == ROUND_SEAT1);
+    g->move[0] = g->move[1] = MOVE_NONE;
+    if (g->score[0] >= GAME_WIN_SCORE || g->score[1] >= GAME_WIN_SCORE) g->state = ROOM_FINISHED;
+    else g->round++;
+    return w;
+}
+
+int game_forfeit(game_t *g, int leaving_seat) {
+    g->flags &= (uint8_t)~GAME_READY(leaving_seat);
+    if (g->state != ROOM_PLAYING && g->state != ROOM_PAUSED) return -1;
+    g->state = ROOM_FINISHED;
+    return 1 - leaving_seat;
+}
+
+int game_pause(game_t *g, int seat) {
+    if (g->state == ROOM_PAUSED) {
+        g->flags |= (uint8_t)GAME_AWAY(seat);
+        return 0;
+    }
+    if (g->state != ROOM_PLAYING) return -1;
+    g->flags |= (uint8_t)GAME_AWAY(seat);
+    g->state = ROOM_PAUSED;
+    return 1;
+}
+
+int game_resume(game_t *g, int seat) {
+    if (g->state != ROOM_PAUSED || !(g->flags & GAME_AWAY(seat))) return -1;
+    g->flags &= (uint8_t)~GAME_AWAY(seat);
+    g->move[0] = g->move[1] = MOVE_NONE;
+    g->state = ROOM_PLAYING;
+    return 0;
+}
+
+move_t move_parse(char ch) {
+    return move_of[(unsigned char)ch];
+}
+
+const char *room_state_name(room_state_t s) {
+    static const char *names[] = { "OPEN", "WAITING", "PLAYING", "PAUSED", "FINISHED" };
+    return (unsigned)s <= ROOM_FINISHED ? names[s] : "?";
+}
@@ -0,0 +1,118 @@
+// handoff.c
+// SOCK_SEQPACKET records for handoff.h: an 8-byte header (type, length)
+// and the payload in one message, descriptors in its control data.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;
+} rec_hdr_t;
+
+static int unix_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static void set_timeouts(int fd) {
+    struct timeval tv = { HANDOFF_TIMEOUT_MS / 1000, (HANDOFF_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (unix_addr(path, &addr) < 0) { fprintf(stderr, "handoff path too long: %s\n", path); exit(1); }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket handoff"); exit(1); }
+    unlink(path); // left behind by the process we took over from, or a crash
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { perror("bind handoff"); exit(1); }
+    if (listen(fd, 1) < 0) { perror("listen handoff"); exit(1); }
+    return fd;
+}
+
+int handoff_accept(int lfd) {
+    int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd >= 0) set_timeouts(fd);
+    return fd;
+}
+
+int handoff_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (unix_addr(path, &addr) < 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    set_timeouts(fd);
+    return fd;
+}
+
+int handoff_send(int fd, uint32_t type, const void *p, size_t len, const int *fds, int nfds) {
+    if (len > HANDOFF_MAX_REC || nfds > HANDOFF_MAX_FDS) return -1;
+    rec_hdr_t h = { type, (uint32_t)len };
+    struct iovec iov[2] = { { &h, sizeof(h) }, { (void *)p, len } };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = len ? 2 : 1 };
+    if (nfds > 0) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)nfds);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * (size_t)nfds);
+    }
+    for (;;) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n >= 0) return (size_t)n == sizeof(h) + len ? 0 : -1;
+        if (errno != EINTR) return -1;
+    }
+}
+
+ssize_t handoff_recv(int fd, uint32_t *type, void *buf, size_t cap, int *fds, int *nfds) {
+    rec_hdr_t h;
+    struct iovec iov[2] = { { &h, sizeof(h) }, { buf, cap } };
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+    ssize_t n;
+    do n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+    *nfds = 0;
+    *type = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); n >= 0 && cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int k = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds + *nfds, CMSG_DATA(cm), sizeof(int) * (size_t)k);
+        *nfds += k;
+    }
+    if (n == 0) return 0;
+    if (n < (ssize_t)sizeof(h) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || h.len != (size_t)n - sizeof(h)) {
+        for (int i=0;i<*nfds;i++) close(fds[i]);
+        *nfds = 0;
+        return -1;
+    }
+    *type = h.type;
+    return (ssize_t)h.len;
+}
@@ -0,0 +1,227 @@
+// journal.c
+// Rings and writer for journal.h. The writer owns the file: it checksums
+// records as it copies them into its batch buffer, writes the batch with
+// one write() and syncs when the fsync interval is up (or on request).
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+#include "log.h"
+
+#define JOURNAL_MAX_RINGS (MAX_WORKERS + 8) // reactors plus helper threads
+#define JOURNAL_OUT_BUF (1 << 20)
+#define JOURNAL_MAGIC "RPSJ\1\0\0\0" // version 1
+#define JOURNAL_FILE_HDR 8
+
+typedef struct {
+    journal_hdr_t h;
+    char payload[JOURNAL_RECORD - sizeof(journal_hdr_t)];
+} journal_slot_t;
+
+_Static_assert(sizeof(journal_slot_t) == JOURNAL_RECORD, "journal_slot_t must fill a slot");
+
+typedef struct {
+    _Alignas(64) atomic_size_t head; // writer
+    _Alignas(64) atomic_size_t tail; // owning thread
+    atomic_size_t dropped;           // owning thread adds, writer reads
+    size_t reported;                 // writer only
+    journal_slot_t slots[JOURNAL_RING_SLOTS];
+} journal_ring_t;
+
+static _Atomic(journal_ring_t *) rings[JOURNAL_MAX_RINGS];
+static atomic_int nrings;
+static __thread journal_ring_t *my_ring;
+static atomic_int journal_on;
+static int journal_fd = -1;
+static int sync_ms;
+static atomic_uint flush_req, flush_done; // journal_flush() handshake
+
+static uint64_t clock_ms(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint32_t record_sum(const journal_hdr_t *h, const void *p) {
+    uint32_t s = 2166136261u; // FNV-1a
+    const unsigned char *b = (const unsigned char *)h + sizeof(h->sum);
+    for (size_t i=0;i<sizeof(*h) - sizeof(h->sum);i++) { s ^= b[i]; s *= 16777619u; }
+    b = p;
+    for (size_t i=0;i<h->len;i++) { s ^= b[i]; s *= 16777619u; }
+    return s;
+}
+
+static journal_ring_t *ring_self(void) {
+    if (my_ring) return my_ring;
+    int idx = atomic_fetch_add_explicit(&nrings, 1, memory_order_relaxed);
+    if (idx >= JOURNAL_MAX_RINGS) return NULL;
+    journal_ring_t *r = aligned_alloc(64, sizeof(*r));
+    if (!r) return NULL;
+    memset(r, 0, sizeof(*r));
+    atomic_store_explicit(&rings[idx], r, memory_order_release);
+    return my_ring = r;
+}
+
+void journal_append(journal_type_t type, const void *p, size_t len) {
+    if (!atomic_load_explicit(&journal_on, memory_order_relaxed)) return;
+    journal_ring_t *r = ring_self();
+    if (!r) {
+        LOG(LOG_WARN, "journal_dropped", " ring=none type=%d", type);
+        return;
+    }
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&r->head, memory_order_acquire) == JOURNAL_RING_SLOTS) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    journal_slot_t *s = &r->slots[tail & (JOURNAL_RING_SLOTS - 1)];
+    s->h.type = (uint16_t)type;
+    s->h.len = (uint16_t)len;
+    s->h.ts_ms = clock_ms(CLOCK_REALTIME);
+    memcpy(s->payload, p, len);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/* ---- writer ---- */
+
+static char *out;
+static size_t out_len;
+
+static void out_write(void) {
+    size_t off = 0;
+    while (off < out_len) {
+        ssize_t w = write(journal_fd, out + off, out_len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            LOG(LOG_ERROR, "journal_write", " err=%s lost=%zu", strerrorname_np(errno), out_len - off);
+            break; // disk full or gone: lose the batch, never stall
+        }
+        off += (size_t)w;
+    }
+    out_len = 0;
+}
+
+/* one pass over every ring into the batch buffer; returns the number of records */
+static size_t drain(void) {
+    size_t total = 0;
+    int n = atomic_load_explicit(&nrings, memory_order_relaxed);
+    if (n > JOURNAL_MAX_RINGS) n = JOURNAL_MAX_RINGS;
+    for (int i=0;i<n;i++) {
+        journal_ring_t *r = atomic_load_explicit(&rings[i], memory_order_acquire);
+        if (!r) continue; // registered, not published yet
+        size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        for (;head != tail;head++) {
+            journal_slot_t *s = &r->slots[head & (JOURNAL_RING_SLOTS - 1)];
+            if (JOURNAL_OUT_BUF - out_len < JOURNAL_RECORD) out_write();
+            s->h.sum = record_sum(&s->h, s->payload);
+            memcpy(out + out_len, s, sizeof(s->h) + s->h.len);
+            out_len += sizeof(s->h) + s->h.len;
+            atomic_store_explicit(&r->head, head + 1, memory_order_release); // slot may be reused now
+            total++;
+        }
+        size_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        if (dropped != r->reported) {
+            LOG(LOG_WARN, "journal_dropped", " ring=%d count=%zu", i, dropped - r->reported);
+            r->reported = dropped;
+        }
+    }
+    return total;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    uint64_t last_sync = clock_ms(CLOCK_MONOTONIC);
+    int dirty = 0;
+    for (;;) {
+        unsigned req = atomic_load_explicit(&flush_req, memory_order_acquire);
+        size_t n = drain();
+        if (out_len) { out_write(); dirty = 1; }
+        uint64_t now = clock_ms(CLOCK_MONOTONIC);
+        int flushing = req != atomic_load_explicit(&flush_done, memory_order_relaxed);
+        if (dirty && (flushing || now - last_sync >= (uint64_t)sync_ms)) {
+            if (fdatasync(journal_fd) < 0) LOG(LOG_ERROR, "journal_sync", " err=%s", strerrorname_np(errno));
+            last_sync = now;
+            dirty = 0;
+        }
+        if (flushing) atomic_store_explicit(&flush_done, req, memory_order_release);
+        if (n == 0) {
+            struct timespec d = { 0, JOURNAL_POLL_MS * 1000000L };
+            nanosleep(&d, NULL);
+        }
+    }
+    return NULL;
+}
+
+void journal_flush(void) {
+    if (!atomic_load(&journal_on)) return;
+    unsigned want = atomic_fetch_add(&flush_req, 1) + 1;
+    struct timespec d = { 0, JOURNAL_POLL_MS * 1000000L };
+    /* the writer drains what was queued before the request, then syncs */
+    for (int tries=0;tries<1000 && (int)(atomic_load(&flush_done) - want) < 0;tries++) nanosleep(&d, NULL);
+}
+
+/* ---- open and replay ---- */
+
+/* length of the intact prefix of the mapped file; every record in it goes to fn */
+static size_t replay(const char *base, size_t size, journal_replay_fn fn, void *arg, size_t *count) {
+    size_t off = JOURNAL_FILE_HDR;
+    *count = 0;
+    while (size - off >= sizeof(journal_hdr_t)) {
+        journal_hdr_t h;
+        memcpy(&h, base + off, sizeof(h));
+        if (h.len > JOURNAL_RECORD - sizeof(h) || size - off - sizeof(h) < h.len) break;
+        const char *p = base + off + sizeof(h);
+        if (record_sum(&h, p) != h.sum) break;
+        if (fn) fn(&h, p, arg);
+        off += sizeof(h) + h.len;
+        (*count)++;
+    }
+    return off;
+}
+
+size_t journal_open(const char *path, int fsync_ms, journal_replay_fn fn, void *arg) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) { perror("open journal"); exit(1); }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat journal"); exit(1); }
+    size_t size = (size_t)st.st_size, count = 0;
+    if (size == 0) {
+        if (write(fd, JOURNAL_MAGIC, JOURNAL_FILE_HDR) != JOURNAL_FILE_HDR) { perror("write journal"); exit(1); }
+    } else if (fn) {
+        char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) { perror("mmap journal"); exit(1); }
+        if (size < JOURNAL_FILE_HDR || memcmp(base, JOURNAL_MAGIC, JOURNAL_FILE_HDR) != 0) {
+            fprintf(stderr, "%s: not a journal of this version\n", path);
+            exit(1);
+        }
+        madvise(base, size, MADV_SEQUENTIAL);
+        size_t valid = replay(base, size, fn, arg, &count);
+        munmap(base, size);
+        if (valid < size) {
+            LOG(LOG_WARN, "journal_truncated", " path=%s cut=%zu", path, size - valid);
+            if (ftruncate(fd, (off_t)valid) < 0) { perror("ftruncate journal"); exit(1); }
+        }
+    }
+    if (lseek(fd, 0, SEEK_END) < 0) { perror("lseek journal"); exit(1); }
+    out = malloc(JOURNAL_OUT_BUF);
+    if (!out) { perror("malloc"); exit(1); }
+    journal_fd = fd;
+    sync_ms = fsync_ms;
+    pthread_t t;
+    if (pthread_create(&t, NULL, writer_main, NULL) != 0) { perror("pthread_create"); exit(1); }
+    pthread_detach(t);
+    atomic_store(&journal_on, 1);
+    return count;
+}
@@ -0,0 +1,219 @@
+// log.c
+// Per-thread rings registered on first use, one writer thread that
+// timestamps nothing itself: records carry the caller's clock reading.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "reactor.h"
+
+#define LOG_MAX_RINGS (MAX_WORKERS + 8) // reactors plus helper threads
+#define LOG_OUT_BUF 65536
+#define LOG_THR_NONE 0xff // logged from a thread that runs no reactor
+
+typedef struct {
+    uint64_t ts_ms; // CLOCK_REALTIME
+    uint16_t len;
+    uint8_t level;
+    uint8_t thr;
+    char text[LOG_RECORD - 12];
+} log_record_t;
+
+_Static_assert(sizeof(log_record_t) == LOG_RECORD, "log_record_t must fill a record");
+
+typedef struct {
+    _Alignas(64) atomic_size_t head; // writer
+    _Alignas(64) atomic_size_t tail; // owning thread
+    atomic_size_t dropped;           // owning thread adds, writer reads
+    size_t reported;                 // writer only
+    log_record_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+atomic_int log_level = LOG_INFO;
+
+static _Atomic(log_ring_t *) rings[LOG_MAX_RINGS];
+static atomic_int nrings;
+static atomic_size_t unregistered_drops; // threads that found no free ring
+static __thread log_ring_t *my_ring;
+
+static const char *const level_names[] = { "debug", "info", "warn", "error" };
+
+int log_parse_level(const char *s) {
+    for (int i=0;i<4;i++) if (strcmp(s, level_names[i]) == 0) return i;
+    return -1;
+}
+
+static log_ring_t *ring_self(void) {
+    if (my_ring) return my_ring;
+    int idx = atomic_fetch_add_explicit(&nrings, 1, memory_order_relaxed);
+    if (idx >= LOG_MAX_RINGS) return NULL;
+    log_ring_t *r = aligned_alloc(64, sizeof(*r));
+    if (!r) return NULL;
+    memset(r, 0, sizeof(*r));
+    atomic_store_explicit(&rings[idx], r, memory_order_release);
+    return my_ring = r;
+}
+
+void log_write(log_level_t lvl, const char *ev, const char *fmt, ...) {
+    log_ring_t *r = ring_self();
+    if (!r) { atomic_fetch_add_explicit(&unregistered_drops, 1, memory_order_relaxed); return; }
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&r->head, memory_order_acquire) == LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    log_record_t *rec = &r->slots[tail & (LOG_RING_SLOTS - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->ts_ms = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+    rec->level = (uint8_t)lvl;
+    int thr = reactor_current();
+    rec->thr = thr < 0 ? LOG_THR_NONE : (uint8_t)thr;
+    int n = snprintf(rec->text, sizeof(rec->text), "ev=%s", ev);
+    if (n > 0 && (size_t)n < sizeof(rec->text)) {
+        va_list ap;
+        va_start(ap, fmt);
+        int m = vsnprintf(rec->text + n, sizeof(rec->text) - (size_t)n, fmt, ap);
+        va_end(ap);
+        if (m > 0) n += m;
+    }
+    if (n < 0) n = 0;
+    rec->len = (uint16_t)((size_t)n < sizeof(rec->text) ? (size_t)n : sizeof(rec->text) - 1); // truncated
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/* ---- writer ---- */
+
+static char out[LOG_OUT_BUF];
+static size_t out_len;
+
+static void out_flush(void) {
+    size_t off = 0;
+    while (off < out_len) {
+        ssize_t w = write(STDERR_FILENO, out + off, out_len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break; // nowhere to write to: lose it, never stall
+        off += (size_t)w;
+    }
+    out_len = 0;
+}
+
+static void out_line(uint64_t ts_ms, int level, int thr, const char *text, size_t len) {
+    if (sizeof(out) - out_len < len + 64) out_flush();
+    char tname[4] = "-";
+    if (thr != LOG_THR_NONE) snprintf(tname, sizeof(tname), "%d", thr);
+    int n = snprintf(out + out_len, sizeof(out) - out_len, "ts=%llu.%03u lvl=%s thr=%s ",
+                     (unsigned long long)(ts_ms / 1000), (unsigned)(ts_ms % 1000), level_names[level & 3], tname);
+    out_len += (size_t)n;
+    memcpy(out + out_len, text, len);
+    out_len += len;
+    out[out_len++] = '\n';
+}
+
+static uint64_t realtime_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* one pass over every ring; returns the number of records written */
+static size_t drain(void) {
+    size_t total = 0;
+    int n = atomic_load_explicit(&nrings, memory_order_relaxed);
+    if (n > LOG_MAX_RINGS) n = LOG_MAX_RINGS;
+    for (int i=0;i<n;i++) {
+        log_ring_t *r = atomic_load_explicit(&rings[i], memory_order_acquire);
+        if (!r) continue; // registered, not published yet
+        size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        for (;head != tail;head++) {
+            log_record_t *rec = &r->slots[head & (LOG_RING_SLOTS - 1)];
+            out_line(rec->ts_ms, rec->level, rec->thr, rec->text, rec->len);
+            atomic_store_explicit(&r->head, head + 1, memory_order_release); // slot may be reused now
+            total++;
+        }
+        size_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        if (dropped != r->reported) {
+            char text[64];
+            int len = snprintf(text, sizeof(text), "ev=log_dropped ring=%d count=%zu", i, dropped - r->reported);
+            out_line(realtime_ms(), LOG_WARN, LOG_THR_NONE, text, (size_t)len);
+            r->reported = dropped;
+        }
+    }
+    static size_t unregistered_reported;
+    size_t lost = atomic_load_explicit(&unregistered_drops, memory_order_relaxed);
+    if (lost != unregistered_reported) {
+        char text[64];
+        int len = snprintf(text, sizeof(text), "ev=log_dropped ring=none count=%zu", lost - unregistered_reported);
+        out_line(realtime_ms(), LOG_WARN, LOG_THR_NONE, text, (size_t)len);
+        unregistered_reported = lost;
+    }
+    /* the signal handler only flips the level; announce it from here */
+    static int shown_level = -1;
+    int lvl = atomic_load_explicit(&log_level, memory_order_relaxed);
+    if (shown_level >= 0 && lvl != shown_level) {
+        char text[32];
+        int len = snprintf(text, sizeof(text), "ev=log_level level=%s", level_names[lvl & 3]);
+        out_line(realtime_ms(), LOG_WARN, LOG_THR_NONE, text, (size_t)len);
+    }
+    shown_level = lvl;
+    return total;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        if (drain() == 0) {
+            if (out_len) out_flush();
+            struct timespec d = { 0, LOG_FLUSH_MS * 1000000L };
+            nanosleep(&d, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void on_level_signal(int sig) {
+    int lvl = atomic_load(&log_level);
+    if (sig == SIGUSR1 && lvl > LOG_DEBUG) atomic_store(&log_level, lvl - 1);
+    if (sig == SIGUSR2 && lvl < LOG_ERROR) atomic_store(&log_level, lvl + 1);
+}
+
+void log_init(log_level_t lvl) {
+    atomic_store(&log_level, (int)lvl);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_level_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+    pthread_t t;
+    if (pthread_create(&t, NULL, writer_main, NULL) != 0) { perror("pthread_create"); exit(1); }
+    pthread_detach(t);
+}
+
+void log_flush(void) {
+    struct timespec d = { 0, LOG_FLUSH_MS * 1000000L };
+    for (int tries=0;tries<100;tries++) {
+        int busy = 0, n = atomic_load_explicit(&nrings, memory_order_relaxed);
+        if (n > LOG_MAX_RINGS) n = LOG_MAX_RINGS;
+        for (int i=0;i<n && !busy;i++) {
+            log_ring_t *r = atomic_load_explicit(&rings[i], memory_order_acquire);
+            busy = r && atomic_load_explicit(&r->head, memory_order_acquire) != atomic_load_explicit(&r->tail, memory_order_acquire);
+        }
+        if (!busy) break;
+        nanosleep(&d, NULL);
+    }
+    d.tv_nsec *= 2; // the writer flushes its buffer once a pass finds nothing new
+    nanosleep(&d, NULL);
+}
@@ -0,0 +1,232 @@
+// metrics.c
+// Shards, aggregation and the admin listener. A scrape sums every shard
+// without stopping the reactors; a counter may be one increment behind its
+// histogram, which is fine for monitoring.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "metrics.h"
+#include "net.h"
+#include "log.h"
+
+#define ADMIN_REQ_MAX 2048
+#define ADMIN_RECV_TIMEOUT_S 1
+
+static metrics_shard_t shards[MAX_WORKERS];
+__thread metrics_shard_t *metrics_self;
+
+static const char *cmd_names[METRICS_MAX_CMDS];
+static int ncmd_names;
+
+static const struct { const char *name, *help; } counter_info[MET_COUNTERS] = {
+    [MET_ACCEPTED] = { "rps_connections_accepted_total", "Connections given a client slot." },
+    [MET_REJECTED] = { "rps_connections_rejected_total", "Connections turned away with SERVER_FULL." },
+    [MET_SHED] = { "rps_connections_shed_total", "Connections closed unread while out of file descriptors." },
+    [MET_CLOSED] = { "rps_connections_closed_total", "Connections closed." },
+    [MET_BYTES_IN] = { "rps_received_bytes_total", "Bytes read from clients." },
+    [MET_LINES_OUT] = { "rps_sent_lines_total", "Reply lines queued." },
+    [MET_OVERLONG] = { "rps_overlong_lines_total", "Lines rejected as too long." },
+    [MET_ROOMS_CREATED] = { "rps_rooms_created_total", "Rooms created." },
+    [MET_ROOMS_RELEASED] = { "rps_rooms_released_total", "Rooms freed." },
+    [MET_SUSPENDED] = { "rps_sessions_suspended_total", "Sessions kept for RECONNECT after a drop." },
+    [MET_RESUMED] = { "rps_sessions_resumed_total", "Successful RECONNECTs." },
+    [MET_ADOPTED] = { "rps_connections_adopted_total", "Connections taken over from the previous process." },
+    [MET_ROOMS_ADOPTED] = { "rps_rooms_adopted_total", "Rooms taken over from the previous process." },
+    [MET_LOSSY_DROPPED] = { "rps_lines_dropped_total", "Lines a spectator missed because its output backed up." },
+    [MET_PAUSED] = { "rps_reads_paused_total", "Times a connection stopped being read until its output drained." },
+    [MET_EVICTED] = { "rps_connections_evicted_total", "Connections closed for not draining their output." },
+    [MET_ABUSE] = { "rps_connections_abusive_total", "Connections closed for exceeding the command rate or sending too many malformed lines." },
+    [MET_REDIRECTS] = { "rps_redirects_total", "Requests redirected to the cluster node that owns the room or session." },
+};
+
+void metrics_init(const char *const *names, int n) {
+    if (n > METRICS_MAX_CMDS) n = METRICS_MAX_CMDS;
+    for (int i=0;i<n;i++) cmd_names[i] = names[i];
+    ncmd_names = n;
+}
+
+void metrics_attach(int idx) {
+    metrics_self = &shards[idx];
+}
+
+/* ---- exposition ---- */
+
+typedef struct {
+    char *p;
+    size_t len, cap;
+} strbuf_t;
+
+static void out(strbuf_t *b, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->p + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < b->cap - b->len) { b->len += (size_t)n; return; }
+        size_t cap = b->cap * 2 + (size_t)n;
+        char *np = realloc(b->p, cap);
+        if (!np) return;
+        b->p = np;
+        b->cap = cap;
+    }
+}
+
+static uint64_t load(const _Atomic uint64_t *p) {
+    return atomic_load_explicit(p, memory_order_relaxed);
+}
+
+static void sum_op(int op, metrics_hist_t *h) {
+    memset(h, 0, sizeof(*h));
+    for (int s=0;s<MAX_WORKERS;s++) {
+        const metrics_hist_t *src = &shards[s].ops[op];
+        metrics_bump(&h->count, load(&src->count));
+        metrics_bump(&h->sum_ns, load(&src->sum_ns));
+        for (int i=0;i<METRICS_BUCKETS;i++) metrics_bump(&h->buckets[i], load(&src->buckets[i]));
+    }
+}
+
+/* upper bound of the bucket holding quantile q */
+static double quantile_s(const metrics_hist_t *h, double q) {
+    uint64_t n = load(&h->count), rank = (uint64_t)(q * (double)n), seen = 0;
+    if (n == 0) return 0;
+    if (rank >= n) rank = n - 1;
+    for (int i=0;i<METRICS_BUCKETS;i++) {
+        seen += load(&h->buckets[i]);
+        if (seen > rank) return (double)metrics_bucket_upper(i) / 1e9;
+    }
+    return (double)metrics_bucket_upper(METRICS_BUCKETS - 1) / 1e9;
+}
+
+/* one series of a histogram family, buckets at powers of two */
+static void out_hist(strbuf_t *b, const char *name, const char *label, const metrics_hist_t *h) {
+    const char *comma = label[0] ? "," : "";
+    uint64_t cum = 0;
+    int i = 0;
+    for (int bit=6;bit<=METRICS_MAX_BIT;bit++) {
+        int last = (bit - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS - 1;
+        for (;i<=last;i++) cum += load(&h->buckets[i]);
+        out(b, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, label, comma, (double)(1ull << (bit + 1)) / 1e9,
+            (unsigned long long)cum);
+    }
+    out(b, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, comma, (unsigned long long)load(&h->count));
+    char braced[64] = "";
+    if (label[0]) snprintf(braced, sizeof(braced), "{%s}", label);
+    out(b, "%s_sum%s %.9f\n", name, braced, (double)load(&h->sum_ns) / 1e9);
+    out(b, "%s_count%s %llu\n", name, braced, (unsigned long long)load(&h->count));
+}
+
+/* the same series as gauges at the histogram's full resolution */
+static void out_quantiles(strbuf_t *b, const char *name, const char *label, const metrics_hist_t *h) {
+    static const double qs[] = { 0.5, 0.99, 0.999 };
+    const char *comma = label[0] ? "," : "";
+    for (size_t k=0;k<sizeof(qs)/sizeof(qs[0]);k++)
+        out(b, "%s{%s%squantile=\"%g\"} %g\n", name, label, comma, qs[k], quantile_s(h, qs[k]));
+}
+
+/* a histogram family and its quantile family; op < 0 is one series per command */
+static void out_op_family(strbuf_t *b, const char *name, const char *help, int op) {
+    static metrics_hist_t h; // only the admin thread renders
+    char qname[64], label[48];
+    snprintf(qname, sizeof(qname), "%s_quantile", name);
+    for (int pass=0;pass<2;pass++) {
+        if (pass == 0) out(b, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+        else out(b, "# HELP %s Upper bound of the bucket holding each quantile of %s.\n# TYPE %s gauge\n",
+                 qname, name, qname);
+        int first = op < 0 ? MET_OP_CMD : op, last = op < 0 ? MET_OP_CMD + ncmd_names - 1 : op;
+        for (int o=first;o<=last;o++) {
+            label[0] = '\0';
+            if (op < 0) {
+                if (!cmd_names[o - MET_OP_CMD]) continue;
+                snprintf(label, sizeof(label), "cmd=\"%s\"", cmd_names[o - MET_OP_CMD]);
+            }
+            sum_op(o, &h);
+            if (op < 0 && load(&h.count) == 0) continue;
+            if (pass == 0) out_hist(b, name, label, &h);
+            else out_quantiles(b, qname, label, &h);
+        }
+    }
+}
+
+static void render(strbuf_t *b) {
+    uint64_t c[MET_COUNTERS] = { 0 };
+    for (int s=0;s<MAX_WORKERS;s++)
+        for (int m=0;m<MET_COUNTERS;m++) c[m] += load(&shards[s].counters[m]);
+    for (int m=0;m<MET_COUNTERS;m++) {
+        out(b, "# HELP %s %s\n# TYPE %s counter\n", counter_info[m].name, counter_info[m].help, counter_info[m].name);
+        out(b, "%s %llu\n", counter_info[m].name, (unsigned long long)c[m]);
+    }
+    out(b, "# HELP rps_clients_connected Open client connections.\n# TYPE rps_clients_connected gauge\n");
+    out(b, "rps_clients_connected %lld\n", (long long)(c[MET_ACCEPTED] + c[MET_ADOPTED] - c[MET_CLOSED]));
+    out(b, "# HELP rps_rooms_active Rooms in use.\n# TYPE rps_rooms_active gauge\n");
+    out(b, "rps_rooms_active %lld\n", (long long)(c[MET_ROOMS_CREATED] + c[MET_ROOMS_ADOPTED] - c[MET_ROOMS_RELEASED]));
+
+    out_op_family(b, "rps_accept_seconds", "Accepting and registering one connection.", MET_OP_ACCEPT);
+    out_op_family(b, "rps_send_line_seconds", "Formatting and queueing one reply line.", MET_OP_SEND);
+    out_op_family(b, "rps_command_seconds", "Handling one command line, replies included.", -1);
+}
+
+/* ---- admin listener ---- */
+
+static int send_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static void serve_one(int fd, strbuf_t *body) {
+    struct timeval tv = { ADMIN_RECV_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char req[ADMIN_REQ_MAX];
+    ssize_t n = recv(fd, req, sizeof(req) - 1, 0); // the request line is all we look at
+    if (n <= 0) return;
+    req[n] = '\0';
+    char head[160];
+    if (strncmp(req, "GET /metrics ", 13) != 0 && strncmp(req, "GET / ", 6) != 0) {
+        int len = snprintf(head, sizeof(head), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        send_all(fd, head, (size_t)len);
+        return;
+    }
+    body->len = 0;
+    render(body);
+    int len = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: %zu\r\nConnection: close\r\n\r\n", body->len);
+    if (send_all(fd, head, (size_t)len) == 0) send_all(fd, body->p, body->len);
+}
+
+static void *admin_main(void *arg) {
+    int lfd = (int)(intptr_t)arg;
+    strbuf_t body = { malloc(65536), 0, 65536 };
+    if (!body.p) return NULL;
+    for (;;) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) LOG(LOG_ERROR, "admin_accept", " err=%s", strerrorname_np(errno));
+            if (errno == EMFILE || errno == ENFILE) sleep(1);
+            continue;
+        }
+        serve_one(fd, &body);
+        close(fd);
+    }
+    return NULL;
+}
+
+void metrics_serve(int port) {
+    int fd = net_listen_admin(port);
+    pthread_t t;
+    if (pthread_create(&t, NULL, admin_main, (void *)(intptr_t)fd) != 0) { perror("pthread_create"); exit(1); }
+    pthread_detach(t);
+}
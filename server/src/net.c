@@ -0,0 +1,94 @@
+// net.c
+// Listener setup and outgoing connections; see net.h for why accepted
+// sockets need no options.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "net.h"
+#include "server.h"
+
+static void set_opt(int fd, int level, int name, int value, const char *what) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        perror(what);
+        exit(1);
+    }
+}
+
+int net_listen(int port, int reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); exit(1); }
+    set_opt(fd, SOL_SOCKET, SO_REUSEADDR, 1, "setsockopt SO_REUSEADDR");
+    /* one socket per reactor, the kernel spreads incoming connections over them */
+    if (reuseport) set_opt(fd, SOL_SOCKET, SO_REUSEPORT, 1, "setsockopt SO_REUSEPORT");
+
+    /* inherited by every accepted socket */
+    set_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "setsockopt TCP_NODELAY"); // replies are already coalesced per iteration
+    set_opt(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "setsockopt SO_KEEPALIVE");
+    set_opt(fd, IPPROTO_TCP, TCP_KEEPIDLE, KEEPALIVE_MS / 1000, "setsockopt TCP_KEEPIDLE");
+    set_opt(fd, IPPROTO_TCP, TCP_KEEPINTVL, TCP_KEEPALIVE_INTVL_S, "setsockopt TCP_KEEPINTVL");
+    set_opt(fd, IPPROTO_TCP, TCP_KEEPCNT, TCP_KEEPALIVE_CNT, "setsockopt TCP_KEEPCNT");
+    /* fixed sizes turn autotuning off, so only when asked for; before listen() for the window scale */
+    if (config.sndbuf > 0) set_opt(fd, SOL_SOCKET, SO_SNDBUF, config.sndbuf, "setsockopt SO_SNDBUF");
+    if (config.rcvbuf > 0) set_opt(fd, SOL_SOCKET, SO_RCVBUF, config.rcvbuf, "setsockopt SO_RCVBUF");
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { perror("bind"); exit(1); }
+    if (listen(fd, config.backlog) < 0) { perror("listen"); exit(1); }
+    return fd;
+}
+
+int net_listen_admin(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); exit(1); }
+    set_opt(fd, SOL_SOCKET, SO_REUSEADDR, 1, "setsockopt SO_REUSEADDR");
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // not reachable from outside the host
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { perror("bind admin"); exit(1); }
+    if (listen(fd, ADMIN_BACKLOG) < 0) { perror("listen admin"); exit(1); }
+    return fd;
+}
+
+int net_connect(const char *host, int port, int timeout_ms) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res;
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) continue;
+        int err = 0;
+        socklen_t elen = sizeof(err);
+        struct pollfd p = { fd, POLLOUT, 0 };
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 &&
+            (errno != EINPROGRESS || poll(&p, 1, timeout_ms) != 1 ||
+             getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &elen) < 0 || err != 0)) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    freeaddrinfo(res);
+    return fd;
+}
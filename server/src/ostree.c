@@ -0,0 +1,132 @@
+// ostree.c
+// Treap with parent links and subtree sizes. Insert descends like a plain
+// BST and rotates the node up past parents of larger priority; remove
+// rotates it down to a leaf first. Every rotation recomputes the two sizes
+// it changes, so size stays exact without a second pass.
+
+#include "ostree.h"
+
+static uint32_t size_of(const ost_node_t *n) {
+    return n ? n->size : 0;
+}
+
+static void fix_size(ost_node_t *n) {
+    n->size = 1 + size_of(n->left) + size_of(n->right);
+}
+
+static uint32_t next_prio(ost_t *t) {
+    uint32_t x = t->seed; // xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return t->seed = x;
+}
+
+/* move x above its parent, keeping the order */
+static void rotate_up(ost_t *t, ost_node_t *x) {
+    ost_node_t *p = x->parent, *g = p->parent;
+    if (x == p->left) {
+        p->left = x->right;
+        if (x->right) x->right->parent = p;
+        x->right = p;
+    } else {
+        p->right = x->left;
+        if (x->left) x->left->parent = p;
+        x->left = p;
+    }
+    p->parent = x;
+    x->parent = g;
+    if (!g) t->root = x;
+    else if (g->left == p) g->left = x;
+    else g->right = x;
+    fix_size(p);
+    fix_size(x);
+}
+
+void ost_init(ost_t *t, ost_cmp_t cmp) {
+    t->root = NULL;
+    t->cmp = cmp;
+    t->seed = 0x9e3779b9u;
+}
+
+void ost_insert(ost_t *t, ost_node_t *n) {
+    n->left = n->right = n->parent = NULL;
+    n->size = 1;
+    n->prio = next_prio(t);
+    if (!t->root) {
+        t->root = n;
+        return;
+    }
+    ost_node_t *cur = t->root;
+    for (;;) {
+        cur->size++;
+        ost_node_t **link = t->cmp(n, cur) < 0 ? &cur->left : &cur->right;
+        if (!*link) {
+            *link = n;
+            break;
+        }
+        cur = *link;
+    }
+    n->parent = cur;
+    while (n->parent && n->prio < n->parent->prio) rotate_up(t, n);
+}
+
+void ost_remove(ost_t *t, ost_node_t *n) {
+    while (n->left || n->right) {
+        ost_node_t *c = !n->left ? n->right : !n->right ? n->left : n->left->prio < n->right->prio ? n->left : n->right;
+        rotate_up(t, c);
+    }
+    ost_node_t *p = n->parent;
+    if (!p) t->root = NULL;
+    else if (p->left == n) p->left = NULL;
+    else p->right = NULL;
+    for (;p;p = p->parent) p->size--;
+    n->parent = NULL;
+    n->size = 0;
+}
+
+ost_node_t *ost_at(const ost_t *t, uint32_t k) {
+    ost_node_t *cur = t->root;
+    while (cur) {
+        uint32_t ls = size_of(cur->left);
+        if (k < ls) {
+            cur = cur->left;
+        } else if (k == ls) {
+            return cur;
+        } else {
+            k -= ls + 1;
+            cur = cur->right;
+        }
+    }
+    return NULL;
+}
+
+ost_node_t *ost_lower_bound(const ost_t *t, ost_key_cmp_t cmp, const void *key) {
+    ost_node_t *cur = t->root, *best = NULL;
+    while (cur) {
+        if (cmp(cur, key) >= 0) {
+            best = cur;
+            cur = cur->left;
+        } else {
+            cur = cur->right;
+        }
+    }
+    return best;
+}
+
+uint32_t ost_rank(const ost_node_t *n) {
+    uint32_t r = size_of(n->left);
+    for (;n->parent;n = n->parent)
+        if (n == n->parent->right) r += size_of(n->parent->left) + 1;
+    return r;
+}
+
+ost_node_t *ost_next(const ost_node_t *n) {
+    if (n->right) {
+        n = n->right;
+        while (n->left) n = n->left;
+        return (ost_node_t *)n;
+    }
+    while (n->parent && n == n->parent->right) n = n->parent;
+    return n->parent;
+}
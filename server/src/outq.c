@@ -0,0 +1,162 @@
+// outq.c
+// Segmented output queue with vectored, partial-write aware flushing.
+// Segments come from pools of the calling thread: a queue is only ever
+// touched by the reactor that owns its connection.
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "outq.h"
+#include "pool.h"
+
+static __thread pool_t chunks; // OUTQ_CHUNK-byte owned segments
+static __thread pool_t refs;   // bare headers for shared segments
+
+static outseg_t *seg_get(pool_t *p, size_t size) {
+    if (p->size == 0 && pool_init(p, size, 0) < 0) return NULL;
+    return pool_get(p);
+}
+
+static void seg_free(outseg_t *s) {
+    snapshot_put(s->shared);
+    if (s->shared) pool_put(&refs, s);
+    else if (s->cap == OUTQ_CHUNK - sizeof(outseg_t)) pool_put(&chunks, s);
+    else free(s); // one-off oversized reservation
+}
+
+static void push_seg(outq_t *q, outseg_t *s) {
+    s->next = NULL;
+    if (q->tail) q->tail->next = s;
+    else q->head = s;
+    q->tail = s;
+}
+
+char *outq_reserve(outq_t *q, size_t n) {
+    outseg_t *t = q->tail;
+    if (t && !t->shared && t->cap - t->len >= n) return t->buf + t->len;
+    outseg_t *s;
+    size_t cap = OUTQ_CHUNK - sizeof(outseg_t);
+    if (n <= cap) {
+        s = seg_get(&chunks, OUTQ_CHUNK);
+    } else {
+        cap = n;
+        s = malloc(sizeof(*s) + cap);
+    }
+    if (!s) return NULL;
+    s->shared = NULL;
+    s->data = s->buf;
+    s->len = s->off = 0;
+    s->cap = cap;
+    push_seg(q, s);
+    return s->buf;
+}
+
+void outq_commit(outq_t *q, size_t n) {
+    q->tail->len += n;
+    q->bytes += n;
+}
+
+int outq_append(outq_t *q, const char *data, size_t len) {
+    char *p = outq_reserve(q, len);
+    if (!p) return -1;
+    memcpy(p, data, len);
+    outq_commit(q, len);
+    return 0;
+}
+
+int outq_append_shared(outq_t *q, snapshot_t *s) {
+    if (s->len <= OUTQ_INLINE_MAX) return outq_append(q, s->data, s->len);
+    outseg_t *seg = seg_get(&refs, sizeof(outseg_t));
+    if (!seg) return -1;
+    atomic_fetch_add_explicit(&s->refs, 1, memory_order_relaxed);
+    seg->shared = s;
+    seg->data = s->data;
+    seg->len = s->len;
+    seg->off = 0;
+    seg->cap = 0;
+    push_seg(q, seg);
+    q->bytes += s->len;
+    return 0;
+}
+
+void outq_consume(outq_t *q, size_t n) {
+    q->bytes -= n;
+    while (n > 0) {
+        outseg_t *s = q->head;
+        size_t left = s->len - s->off;
+        if (n < left) { s->off += n; return; }
+        n -= left;
+        q->head = s->next; // an idle connection keeps no chunk; the pool hands the same one back
+        if (!q->head) q->tail = NULL;
+        seg_free(s);
+    }
+}
+
+int outq_iov(const outq_t *q, struct iovec *iov, size_t *bytes) {
+    int n = 0;
+    size_t batch = 0;
+    for (const outseg_t *s = q->head; s && n < OUTQ_IOV; s = s->next) {
+        if (s->len == s->off) continue;
+        iov[n].iov_base = (void *)(s->data + s->off);
+        iov[n].iov_len = s->len - s->off;
+        batch += iov[n].iov_len;
+        n++;
+    }
+    *bytes = batch;
+    return n;
+}
+
+int outq_flush(outq_t *q, int fd) {
+    while (q->bytes > 0) {
+        struct iovec iov[OUTQ_IOV];
+        size_t batch;
+        int n = outq_iov(q, iov, &batch);
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = (size_t)n };
+        /* more segments than fit in one call: let the kernel hold the segment open.
+         * MSG_DONTWAIT: io_uring connections are blocking sockets */
+        int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (batch < q->bytes ? MSG_MORE : 0);
+        ssize_t w = sendmsg(fd, &msg, flags);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        outq_consume(q, (size_t)w);
+        if ((size_t)w < batch) return 0; // socket buffer full, resume on EPOLLOUT
+    }
+    return 0;
+}
+
+void outq_clear(outq_t *q) {
+    outseg_t *s = q->head;
+    while (s) {
+        outseg_t *next = s->next;
+        seg_free(s);
+        s = next;
+    }
+    q->head = q->tail = NULL;
+    q->bytes = 0;
+}
+
+size_t outq_owned(const outq_t *q) {
+    size_t n = 0;
+    for (const outseg_t *s = q->head; s; s = s->next) if (!s->shared) n += s->len - s->off;
+    return n;
+}
+
+size_t outq_peek(const outq_t *q, size_t off, char *dst, size_t n) {
+    size_t got = 0;
+    for (const outseg_t *s = q->head; s && got < n; s = s->next) {
+        size_t left = s->len - s->off;
+        if (off >= left) { off -= left; continue; }
+        size_t k = left - off < n - got ? left - off : n - got;
+        memcpy(dst + got, s->data + s->off + off, k);
+        got += k;
+        off = 0;
+    }
+    return got;
+}
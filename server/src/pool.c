@@ -0,0 +1,22 @@
+// pool.c
+// Slab carving for pool.h. Objects are pushed in reverse so the first
+// pool_get() calls walk the slab front to back.
+
+#include <stdlib.h>
+
+#include "pool.h"
+
+int pool_init(pool_t *p, size_t size, size_t prealloc) {
+    p->size = (size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    p->free = NULL;
+    p->total = 0;
+    return prealloc ? pool_grow(p, prealloc) : 0;
+}
+
+int pool_grow(pool_t *p, size_t n) {
+    char *slab = aligned_alloc(POOL_ALIGN, p->size * n);
+    if (!slab) return -1;
+    for (size_t i=n;i-->0;) pool_put(p, slab + i * p->size);
+    p->total += n;
+    return 0;
+}
@@ -0,0 +1,991 @@
+// reactor.c
+// Edge-triggered epoll reactors, one per worker thread.
+// - each reactor owns a listen fd, an eventfd and the clients it accepted
+// - every readiness edge is drained until EAGAIN
+// - complete lines are handed to handle_line(); replies are queued (outq.c)
+//   and flushed with one sendmsg per client per loop iteration, the rest
+//   waits for EPOLLOUT
+// - a binary client's frames go to handle_frame() instead, and what is
+//   written to it is framed on the way into its queue (codec.c)
+// - bytes for a client on another reactor travel through that reactor's
+//   SPSC inbox; peers are woken once per iteration via their eventfd
+// - timeouts live on a per-reactor timer wheel; epoll_wait sleeps until its
+//   next tick at most
+// - for a hot restart reactor_quiesce() parks every reactor at the end of
+//   an iteration: parked ones only handle mail, until none is in flight
+// - with --io uring the same loop runs on an io_uring per reactor instead:
+//   one multishot accept, one multishot recv per client into a ring of
+//   provided buffers, at most one vectored sendmsg per client in flight;
+//   a client is freed once the last of its requests has completed
+// - backpressure: a client with more than OUTQ_HIGH unsent is not read
+//   until it is back under OUTQ_LOW; one that holds more than OUTQ_OWNED_MAX
+//   of its own output, or stays paused for DRAIN_TIMEOUT_MS, is evicted
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "reactor.h"
+#include "mailbox.h"
+#include "pool.h"
+#include "log.h"
+#include "metrics.h"
+#include "uring.h"
+#include "codec.h"
+
+#define MAX_EVENTS 256
+#define POOL_PREALLOC_MAX 4096 // clients carved up front per reactor; more slabs on demand
+#define OUTQ_HIGH (256 * 1024)      // unsent bytes that pause reading a client
+#define OUTQ_LOW (64 * 1024)        // ... and that resume it
+#define OUTQ_OWNED_MAX (1024 * 1024) // unsent bytes outside shared buffers before eviction
+#define DRAIN_TIMEOUT_MS 30000      // longest a client may stay paused
+#define URING_ENTRIES 4096     // SQ size; the CQ gets twice as many
+#define URING_BUFS 4096        // provided receive buffers per reactor
+#define URING_BUF_SIZE 1024    // bytes per provided buffer (one recv completion at most)
+#define URING_GROUP 0
+
+/* io_uring user_data: what completed, in the low bits of a 64-aligned pointer */
+enum { UD_IGNORE, UD_ACCEPT, UD_WAKE, UD_RECV, UD_SEND };
+#define UD(p, tag) ((uint64_t)(uintptr_t)(p) | (tag))
+#define UD_TAG(ud) ((int)((ud) & 7))
+#define UD_PTR(ud) ((void *)(uintptr_t)((ud) & ~(uint64_t)7))
+
+/* a sendmsg in flight: the kernel reads msg and iov until it completes */
+typedef struct uring_send {
+    struct msghdr msg;
+    struct iovec iov[OUTQ_IOV];
+    client_t *c;
+} uring_send_t;
+
+/* mail that did not fit into a peer's inbox, retried every iteration */
+typedef struct {
+    mail_t *items;
+    size_t len, cap;
+} spill_t;
+
+typedef struct reactor {
+    int idx;
+    int epfd, evfd, listen_fd;
+    int spare_fd;               // kept open for accept_shed()
+    pthread_t thread;
+    mailbox_t *inbox;           // inbox[p] is written only by reactor p
+    spill_t spill[MAX_WORKERS]; // indexed by destination reactor
+    uint64_t wake_mask;         // peers that got mail this iteration
+    client_t *flush_head;
+    client_t *dead_head;
+    uint64_t now_ms;            // CLOCK_MONOTONIC, sampled after each epoll_wait
+    timer_wheel_t wheel;
+    pool_t client_pool;         // client_t
+    pool_t rbuf_pool;           // RECV_BUF receive buffers
+    char line[LINE_BUF];        // conn_reserve of a binary client: the line to frame on commit
+    /* io_uring backend, set up on the reactor's own thread */
+    uring_t *ring;              // NULL: epoll
+    uring_bufs_t bufs;          // multishot recv lands here
+    pool_t send_pool;           // uring_send_t
+    tw_timer_t accept_timer;    // re-arms accept after an error ended it
+    /* hot restart, read by reactor_quiesce() */
+    atomic_int parked;          // in park()
+    atomic_int busy;            // in one pass of park()
+    atomic_int spilled;         // park() left mail in spill[]
+    _Atomic uint64_t parked_work; // park() passes that handled mail
+} reactor_t;
+
+static reactor_t *reactors;
+static int nreactors;
+static __thread reactor_t *self;
+static atomic_int parking; // reactor_quiesce() until reactor_resume()
+static void (*start_hook)(void);
+static pthread_barrier_t start_barrier; // nobody handles events before every start_hook ran
+
+static uint64_t clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+int reactor_index(void) {
+    return self ? self->idx : 0;
+}
+
+int reactor_current(void) {
+    return self ? self->idx : -1;
+}
+
+int reactor_count(void) {
+    return nreactors;
+}
+
+uint64_t reactor_now_ms(void) {
+    return self ? self->now_ms : clock_ms();
+}
+
+void reactor_timer_arm(tw_timer_t *t, uint64_t delay_ms) {
+    /* the wheel counts from the start of the current tick: add the part
+     * already elapsed so t never fires before now_ms + delay_ms */
+    tw_arm(&self->wheel, t, delay_ms + (self->now_ms - self->wheel.start_ms) % TW_TICK_MS);
+}
+
+void reactor_timer_cancel(tw_timer_t *t) {
+    tw_cancel(&self->wheel, t);
+}
+
+static void queue_flush(client_t *c) {
+    if (c->flush_queued) return;
+    c->flush_queued = 1;
+    c->flush_next = self->flush_head;
+    self->flush_head = c;
+}
+
+/* a binary client's output: each text line as a frame, in owned chunks */
+static int conn_write_frames(client_t *c, const char *text, size_t len) {
+    while (len > 0) {
+        const char *nl = memchr(text, '\n', len);
+        size_t n = nl ? (size_t)(nl - text) + 1 : len;
+        size_t l = nl ? n - 1 : n;
+        if (l > 0 && text[l-1] == '\r') l--;
+        if (l > 0) {
+            char *dst = outq_reserve(&c->out, CODEC_LINE_OUT);
+            if (!dst) return -1;
+            outq_commit(&c->out, codec_encode_line(text, l, (uint8_t *)dst));
+        }
+        text += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int conn_write(client_t *c, const char *data, size_t len) {
+    if (c->dead) return -1;
+    queue_flush(c);
+    if (c->binary) return conn_write_frames(c, data, len);
+    return outq_append(&c->out, data, len);
+}
+
+char *conn_reserve(client_t *c, size_t n) {
+    if (c->dead) return NULL;
+    queue_flush(c);
+    if (c->binary) return n <= sizeof(self->line) ? self->line : NULL;
+    return outq_reserve(&c->out, n);
+}
+
+void conn_commit(client_t *c, size_t n) {
+    if (c->binary) conn_write_frames(c, self->line, n);
+    else outq_commit(&c->out, n);
+}
+
+/* binary clients get their own framed copy: frames are per client */
+int conn_write_shared(client_t *c, snapshot_t *s) {
+    if (c->dead) return -1;
+    queue_flush(c);
+    if (c->binary) return conn_write_frames(c, s->data, s->len);
+    return outq_append_shared(&c->out, s);
+}
+
+static void uring_cancel(client_t *c);
+static void uring_cancel_recv(client_t *c);
+
+/* close now, free at the end of the iteration (epoll may still hold events
+ * for c). With io_uring the fd stays open until every request on it has
+ * completed, so nothing can land on a reused fd number. */
+static void conn_close(client_t *c) {
+    if (c->dead) return;
+    c->dead = 1;
+    metrics_add(MET_CLOSED, 1);
+    reactor_timer_cancel(&c->drain_timer);
+    if (!self->ring) close(c->fd); // also drops it from the epoll set
+    else if (c->uring_ops) uring_cancel(c);
+    client_close(c);
+    c->dead_next = self->dead_head;
+    self->dead_head = c;
+}
+
+void conn_drop(client_t *c) {
+    if (c->dead) return;
+    if (!c->send_inflight) outq_flush(&c->out, c->fd); // past a sendmsg in flight nothing may jump the queue
+    conn_close(c);
+}
+
+static void conn_evict(client_t *c, const char *why) {
+    LOG(LOG_WARN, "evict", " fd=%d reason=%s unsent=%zu", c->fd, why, c->out.bytes);
+    metrics_add(MET_EVICTED, 1);
+    conn_close(c);
+}
+
+static void conn_drain_expired(tw_timer_t *t);
+
+/* stop reading c: replies pile up faster than it takes them */
+static void conn_pause(client_t *c) {
+    c->rpaused = 1;
+    metrics_add(MET_PAUSED, 1);
+    c->drain_timer.cb = conn_drain_expired;
+    reactor_timer_arm(&c->drain_timer, DRAIN_TIMEOUT_MS);
+    if (self->ring && c->recv_armed) uring_cancel_recv(c);
+}
+
+/* whether c is paused, pausing it first if its output is over OUTQ_HIGH */
+static int conn_throttled(client_t *c) {
+    if (!c->rpaused && c->out.bytes > OUTQ_HIGH) conn_pause(c);
+    return c->rpaused;
+}
+
+/* binary: hand out the next frame if it is complete; 0 if it is not */
+static int conn_parse_frame(client_t *c) {
+    const uint8_t *p = (const uint8_t *)c->rbuf + c->rhead;
+    size_t avail = (size_t)(c->rtail - c->rhead), hdr, len;
+    int r = codec_frame(p, avail, &hdr, &len);
+    if (r < 0) { // no way to find the next frame: answer and give up on the stream
+        handle_frame(c, NULL, 0);
+        c->closing = 1;
+        return 0;
+    }
+    if (r == 0 || avail < hdr + len) return 0;
+    c->rhead += (uint16_t)(hdr + len);
+    handle_frame(c, (const char *)p + hdr, len);
+    return 1;
+}
+
+/* frame CRLF-terminated lines in place and hand them out as (ptr,len) views;
+ * with throttle set, stop at the first line seen while c is paused */
+static void conn_parse_lines(client_t *c, int throttle) {
+    while (c->rhead < c->rtail && !c->closing && !c->dead && !(throttle && conn_throttled(c))) {
+        if (c->binary) { // from the line that negotiated it on
+            if (!conn_parse_frame(c)) break;
+            continue;
+        }
+        char *start = c->rbuf + c->rhead;
+        size_t avail = c->rtail - c->rhead;
+        char *nl = memchr(start + c->rscan, '\n', avail - c->rscan);
+        if (!nl) {
+            c->rscan = avail;
+            if (!c->discard && avail >= LINE_BUF) {
+                handle_overlong_line(c);
+                c->discard = 1;
+            }
+            if (c->discard) c->rhead = c->rtail = c->rscan = 0; // nothing of it is kept
+            break;
+        }
+        size_t len = (size_t)(nl - start);
+        c->rhead += len + 1;
+        c->rscan = 0;
+        if (c->discard) { c->discard = 0; continue; } // tail of a rejected line
+        if (len + 1 > LINE_BUF) { handle_overlong_line(c); continue; }
+        if (len > 0 && start[len-1] == '\r') len--;
+        handle_line(c, start, len);
+    }
+    if (c->closing) c->rhead = c->rtail;
+    if (c->rhead == c->rtail) c->rhead = c->rtail = c->rscan = 0;
+}
+
+static void conn_parse(client_t *c) { conn_parse_lines(c, 1); }
+
+/* make room at the end of rbuf by sliding the unparsed bytes to the front */
+static void conn_compact(client_t *c) {
+    if (c->rhead == 0) return;
+    memmove(c->rbuf, c->rbuf + c->rhead, c->rtail - c->rhead);
+    c->rtail -= c->rhead;
+    c->rhead = 0;
+}
+
+/* a connection holds a receive buffer only while a partial line is pending */
+static void conn_release_rbuf(client_t *c) {
+    if (!c->rbuf) return;
+    pool_put(&self->rbuf_pool, c->rbuf);
+    c->rbuf = NULL;
+}
+
+static void conn_free(client_t *c) {
+    outq_clear(&c->out);
+    conn_release_rbuf(c);
+    pool_put(&self->client_pool, c);
+}
+
+static void conn_on_event(client_t *c, uint32_t events) {
+    if (c->dead) return;
+    if ((events & EPOLLIN) && !c->rpaused) { // paused: conn_resume reads what this edge announced
+        if (!c->rbuf && !(c->rbuf = pool_get(&self->rbuf_pool))) { conn_close(c); return; }
+        while (!c->closing && !c->dead && !c->rpaused) {
+            if (c->rtail == RECV_BUF) conn_compact(c); // a partial line never exceeds LINE_BUF
+            ssize_t n = recv(c->fd, c->rbuf + c->rtail, RECV_BUF - c->rtail, 0);
+            if (n > 0) {
+                c->rtail += (size_t)n;
+                c->last_seen_ms = self->now_ms;
+                metrics_add(MET_BYTES_IN, (uint64_t)n);
+                conn_parse(c);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            conn_close(c); // EOF or hard error
+            return;
+        }
+        if (c->rtail == 0) conn_release_rbuf(c);
+    } else if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+        conn_close(c);
+        return;
+    }
+    if (!c->dead) queue_flush(c);
+}
+
+/* out of fds: accept into the spare one and close at once, so the backlog
+ * drains instead of waking us again and again. 0 once nothing is pending
+ * (accept4 reports EMFILE even on an empty backlog). */
+static int accept_shed(void) {
+    close(self->spare_fd);
+    int fd = accept(self->listen_fd, NULL, NULL);
+    if (fd >= 0) { close(fd); metrics_add(MET_SHED, 1); }
+    self->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return fd >= 0;
+}
+
+/* a client for a freshly accepted fd; NULL (fd closed) if it is turned away */
+static client_t *conn_open(int fd) {
+    client_t *c = pool_get(&self->client_pool);
+    if (!c) { close(fd); return NULL; }
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    if (client_open(c) < 0) {
+        close(fd);
+        pool_put(&self->client_pool, c);
+        metrics_add(MET_REJECTED, 1);
+        return NULL;
+    }
+    metrics_add(MET_ACCEPTED, 1);
+    return c;
+}
+
+/* drain the whole backlog: edge-triggered, so stop only on EAGAIN */
+static void accept_all(void) {
+    for (;;) {
+        uint64_t t0 = metrics_now_ns();
+        int connfd = accept4(self->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if ((errno == EMFILE || errno == ENFILE) && self->spare_fd >= 0) {
+                if (accept_shed()) continue;
+                return;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) LOG(LOG_ERROR, "accept", " err=%s", strerrorname_np(errno));
+            return;
+        }
+        client_t *c = conn_open(connfd);
+        if (!c) continue;
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+        if (epoll_ctl(self->epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+            LOG(LOG_ERROR, "epoll_add", " err=%s", strerrorname_np(errno));
+            conn_close(c);
+            continue;
+        }
+        metrics_record(MET_OP_ACCEPT, metrics_now_ns() - t0);
+    }
+}
+
+/* ---- cross-reactor mail ---- */
+
+static int spill_push(spill_t *sp, const mail_t *m) {
+    if (sp->len == sp->cap) {
+        size_t cap = sp->cap ? sp->cap * 2 : 64;
+        mail_t *ni = realloc(sp->items, cap * sizeof(*ni));
+        if (!ni) return -1;
+        sp->items = ni;
+        sp->cap = cap;
+    }
+    sp->items[sp->len++] = *m;
+    return 0;
+}
+
+static void mail_free(mail_t *m) {
+    free(m->data);
+    snapshot_put(m->shared);
+}
+
+static void mail_post(int dst, mail_t *m) {
+    spill_t *sp = &self->spill[dst];
+    /* keep ordering: once something spilled, everything after it spills too */
+    if (sp->len > 0 || mailbox_push(&reactors[dst].inbox[self->idx], m) < 0) {
+        if (spill_push(sp, m) < 0) { mail_free(m); return; }
+    }
+    self->wake_mask |= 1ull << dst;
+}
+
+int client_send(client_ref_t to, const char *data, size_t len) {
+    int dst = REF_REACTOR(to);
+    if (dst == self->idx) {
+        client_t *c = client_lookup(to);
+        return c ? conn_write(c, data, len) : -1;
+    }
+    if (to == CLIENT_REF_NONE || dst >= nreactors) return -1;
+    mail_t m = { .kind = MAIL_DELIVER, .to = to, .data = malloc(len), .len = len };
+    if (!m.data) return -1;
+    memcpy(m.data, data, len);
+    mail_post(dst, &m);
+    return 0;
+}
+
+/* on the recipient's reactor */
+static int deliver_shared(client_t *c, snapshot_t *s, size_t max_queued) {
+    if (c->out.bytes > max_queued) {
+        metrics_add(MET_LOSSY_DROPPED, 1);
+        return 0;
+    }
+    return conn_write_shared(c, s);
+}
+
+int client_send_lossy(client_ref_t to, snapshot_t *s, size_t max_queued) {
+    int dst = REF_REACTOR(to);
+    if (dst == self->idx) {
+        client_t *c = client_lookup(to);
+        return c ? deliver_shared(c, s, max_queued) : -1;
+    }
+    if (to == CLIENT_REF_NONE || dst >= nreactors) return -1;
+    mail_t m = { .kind = MAIL_SHARED, .to = to, .len = max_queued, .shared = snapshot_get(s) };
+    mail_post(dst, &m);
+    return 0;
+}
+
+int client_send_shared(client_ref_t to, snapshot_t *s) {
+    return client_send_lossy(to, s, SIZE_MAX);
+}
+
+void reactor_call(int dst, void (*fn)(uint64_t arg), uint64_t arg) {
+    mail_t m = { .kind = MAIL_CALL, .to = arg, .fn = fn };
+    mail_post(dst, &m); // inbox[self] of our own reactor is drained like any other
+}
+
+static void mail_handle(mail_t *m) {
+    switch (m->kind) {
+    case MAIL_DELIVER: {
+        client_t *c = client_lookup(m->to); // NULL if it disconnected meanwhile
+        if (c) conn_write(c, m->data, m->len);
+        break;
+    }
+    case MAIL_SHARED: {
+        client_t *c = client_lookup(m->to);
+        if (c) deliver_shared(c, m->shared, m->len);
+        break;
+    }
+    case MAIL_CALL:
+        m->fn(m->to);
+        break;
+    }
+    mail_free(m);
+}
+
+/* returns how many were handled */
+static int mail_drain(void) {
+    uint64_t v;
+    int n = 0;
+    /* reset the eventfd before draining so a post racing with us re-arms it */
+    if (read(self->evfd, &v, sizeof(v)) < 0 && errno != EAGAIN) LOG(LOG_ERROR, "eventfd_read", " err=%s", strerrorname_np(errno));
+    for (int p=0;p<nreactors;p++) {
+        mail_t m;
+        while (mailbox_pop(&self->inbox[p], &m) == 0) { mail_handle(&m); n++; }
+    }
+    return n;
+}
+
+/* retry spilled mail; returns 1 if some is still waiting */
+static int spill_retry(void) {
+    int pending = 0;
+    for (int d=0;d<nreactors;d++) {
+        spill_t *sp = &self->spill[d];
+        size_t i = 0;
+        while (i < sp->len && mailbox_push(&reactors[d].inbox[self->idx], &sp->items[i]) == 0) i++;
+        if (i > 0) {
+            memmove(sp->items, sp->items + i, (sp->len - i) * sizeof(*sp->items));
+            sp->len -= i;
+            self->wake_mask |= 1ull << d;
+        }
+        if (sp->len > 0) pending = 1;
+    }
+    return pending;
+}
+
+static void wake_peers(void) {
+    uint64_t one = 1;
+    while (self->wake_mask) {
+        int d = __builtin_ctzll(self->wake_mask);
+        self->wake_mask &= self->wake_mask - 1;
+        if (write(reactors[d].evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            LOG(LOG_ERROR, "eventfd_write", " peer=%d err=%s", d, strerrorname_np(errno));
+    }
+}
+
+/* ---- loop ---- */
+
+static int uring_send(client_t *c);
+static int uring_recv_arm(client_t *c);
+
+/* output is back under OUTQ_LOW: parse what waited, then read again */
+static void conn_resume(client_t *c) {
+    c->rpaused = 0;
+    reactor_timer_cancel(&c->drain_timer);
+    if (c->rbuf) conn_parse(c);
+    if (c->dead || c->rpaused) return;
+    if (c->rtail == 0) conn_release_rbuf(c);
+    if (!self->ring) conn_on_event(c, EPOLLIN); // edge-triggered: what arrived meanwhile raised no new edge
+    else if (!c->recv_armed && uring_recv_arm(c) < 0) conn_close(c);
+}
+
+static void conn_drain_expired(tw_timer_t *t) {
+    client_t *c = tw_entry(t, client_t, drain_timer);
+    if (c->out.bytes <= OUTQ_LOW) conn_resume(c); // drained, but no flush noticed (a failed hot restart)
+    else conn_evict(c, "stalled");
+}
+
+/* after a flush: evict, pause or resume c by how much output it has left */
+static void conn_backpressure(client_t *c) {
+    if (c->out.bytes <= OUTQ_LOW) {
+        if (c->rpaused && !atomic_load_explicit(&parking, memory_order_relaxed)) conn_resume(c);
+        return;
+    }
+    if (c->out.bytes > OUTQ_OWNED_MAX && outq_owned(&c->out) > OUTQ_OWNED_MAX) { conn_evict(c, "output_limit"); return; }
+    conn_throttled(c);
+}
+
+/* epoll: write what the socket takes now; io_uring: keep one sendmsg in flight */
+static int conn_flush(client_t *c) {
+    if (!self->ring) return outq_flush(&c->out, c->fd);
+    if (c->send_inflight || outq_empty(&c->out)) return 0; // its completion queues c again
+    return uring_send(c);
+}
+
+/* end of iteration: flush touched clients, hand mail to peers, free the dead */
+static int loop_tail(void) {
+    while (self->flush_head) {
+        client_t *c = self->flush_head;
+        self->flush_head = c->flush_next;
+        c->flush_queued = 0;
+        if (c->dead) continue;
+        if (conn_flush(c) < 0 || (c->closing && outq_empty(&c->out))) conn_close(c);
+        else conn_backpressure(c);
+    }
+    int pending = spill_retry();
+    wake_peers();
+    while (self->dead_head) {
+        client_t *c = self->dead_head;
+        self->dead_head = c->dead_next;
+        if (c->uring_ops) { c->dead = 2; continue; } // freed by its last completion
+        if (self->ring) close(c->fd);
+        conn_free(c);
+    }
+    return pending;
+}
+
+/* ---- io_uring backend ---- */
+
+static struct io_uring_sqe *uring_get(void) {
+    struct io_uring_sqe *sqe = uring_sqe(self->ring);
+    if (!sqe) LOG(LOG_ERROR, "uring_sqe", " err=%s", strerrorname_np(errno));
+    return sqe;
+}
+
+static void uring_accept_arm(void) {
+    struct io_uring_sqe *sqe = uring_get();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = self->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC; // blocking: io_uring waits for readiness itself
+    sqe->user_data = UD(NULL, UD_ACCEPT);
+}
+
+static void uring_accept_retry(tw_timer_t *t) {
+    (void)t;
+    uring_accept_arm();
+}
+
+static void uring_wake_arm(void) {
+    struct io_uring_sqe *sqe = uring_get();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = self->evfd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = UD(NULL, UD_WAKE);
+}
+
+static int uring_recv_arm(client_t *c) {
+    struct io_uring_sqe *sqe = uring_get();
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_GROUP;
+    sqe->user_data = UD(c, UD_RECV);
+    c->uring_ops++;
+    c->recv_armed = 1;
+    return 0;
+}
+
+static int uring_send(client_t *c) {
+    uring_send_t *s = pool_get(&self->send_pool);
+    if (!s) return -1;
+    struct io_uring_sqe *sqe = uring_get();
+    if (!sqe) { pool_put(&self->send_pool, s); return -1; }
+    size_t batch;
+    memset(&s->msg, 0, sizeof(s->msg));
+    s->msg.msg_iov = s->iov;
+    s->msg.msg_iovlen = (size_t)outq_iov(&c->out, s->iov, &batch);
+    s->c = c;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&s->msg;
+    sqe->msg_flags = MSG_NOSIGNAL | (batch < c->out.bytes ? MSG_MORE : 0);
+    sqe->user_data = UD(s, UD_SEND);
+    c->send_inflight = 1;
+    c->uring_ops++;
+    return 0;
+}
+
+/* every request still on c's fd completes with -ECANCELED (or its result) */
+static void uring_cancel(client_t *c) {
+    struct io_uring_sqe *sqe = uring_get();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = c->fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = UD(NULL, UD_IGNORE);
+}
+
+/* end c's multishot recv; its last completion comes with -ECANCELED */
+static void uring_cancel_recv(client_t *c) {
+    struct io_uring_sqe *sqe = uring_get();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = UD(c, UD_RECV);
+    sqe->user_data = UD(NULL, UD_IGNORE);
+}
+
+/* the last completion of a client that is off the dead list */
+static void uring_reap(client_t *c) {
+    if (c->dead != 2 || c->uring_ops) return;
+    close(c->fd);
+    conn_free(c);
+}
+
+/* received bytes to the parser. With no partial line pending they are framed
+ * right in the provided buffer; only the start of an unfinished line is
+ * copied to a receive buffer of our own. */
+static void conn_feed(client_t *c, char *data, size_t n) {
+    c->last_seen_ms = self->now_ms;
+    metrics_add(MET_BYTES_IN, (uint64_t)n);
+    if (c->closing) return;
+    if (c->rtail == 0) {
+        char *own = c->rbuf;
+        c->rbuf = data;
+        c->rtail = (uint16_t)n;
+        conn_parse(c);
+        c->rbuf = own;
+        if (c->dead) { c->rhead = c->rtail = c->rscan = 0; return; }
+        size_t left = (size_t)(c->rtail - c->rhead);
+        if (left == 0) { conn_release_rbuf(c); return; }
+        if (!c->rbuf && !(c->rbuf = pool_get(&self->rbuf_pool))) { conn_close(c); return; }
+        memcpy(c->rbuf, data + c->rhead, left);
+        c->rhead = 0;
+        c->rtail = (uint16_t)left; // rscan counts from rhead and stays valid
+        return;
+    }
+    while (n > 0 && !c->closing && !c->dead) {
+        if (c->rtail == RECV_BUF) conn_compact(c); // a partial line never exceeds LINE_BUF
+        if (c->rtail == RECV_BUF) { conn_parse_lines(c, 0); continue; } // paused, recv not cancelled yet: past OUTQ_HIGH
+        size_t room = (size_t)(RECV_BUF - c->rtail);
+        size_t k = room < n ? room : n;
+        memcpy(c->rbuf + c->rtail, data, k);
+        c->rtail += (uint16_t)k;
+        data += k;
+        n -= k;
+        conn_parse(c);
+    }
+    if (c->rtail == 0) conn_release_rbuf(c);
+}
+
+static void uring_on_accept(const struct io_uring_cqe *e) {
+    if (e->res >= 0) {
+        uint64_t t0 = metrics_now_ns();
+        client_t *c = conn_open(e->res);
+        if (c && uring_recv_arm(c) < 0) conn_close(c);
+        if (c) metrics_record(MET_OP_ACCEPT, metrics_now_ns() - t0);
+    } else if (e->res == -EMFILE || e->res == -ENFILE) {
+        while (self->spare_fd >= 0 && accept_shed()) {}
+    } else if (e->res != -ECONNABORTED && e->res != -EINTR) {
+        LOG(LOG_ERROR, "accept", " err=%s", strerrorname_np(-e->res));
+    }
+    if (e->flags & IORING_CQE_F_MORE) return;
+    /* an error ended the multishot: retry on the next tick instead of spinning on it */
+    if (e->res >= 0) uring_accept_arm();
+    else reactor_timer_arm(&self->accept_timer, TW_TICK_MS);
+}
+
+static void uring_on_recv(client_t *c, const struct io_uring_cqe *e) {
+    if (e->flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = e->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (e->res > 0 && !c->dead) conn_feed(c, uring_buf(&self->bufs, bid), (size_t)e->res);
+        uring_buf_put(&self->bufs, bid);
+        uring_bufs_commit(&self->bufs);
+    }
+    if (e->flags & IORING_CQE_F_MORE) return;
+    c->uring_ops--;
+    c->recv_armed = 0;
+    if (c->dead) { uring_reap(c); return; }
+    if (c->rpaused && e->res != 0) return; // cancelled by conn_pause; conn_resume re-arms
+    /* data with no F_MORE: the multishot stopped (CQ overflow); -ENOBUFS: all buffers were out */
+    if ((e->res > 0 || e->res == -ENOBUFS) && uring_recv_arm(c) == 0) return;
+    conn_close(c); // EOF or hard error
+}
+
+static void uring_on_send(uring_send_t *s, const struct io_uring_cqe *e) {
+    client_t *c = s->c;
+    pool_put(&self->send_pool, s);
+    c->uring_ops--;
+    c->send_inflight = 0;
+    if (c->dead) { uring_reap(c); return; }
+    if (e->res < 0) { conn_close(c); return; }
+    outq_consume(&c->out, (size_t)e->res);
+    queue_flush(c); // the rest, or the close after QUIT
+}
+
+static void uring_complete(const struct io_uring_cqe *e) {
+    switch (UD_TAG(e->user_data)) {
+    case UD_ACCEPT: uring_on_accept(e); break;
+    case UD_WAKE:
+        mail_drain();
+        if (!(e->flags & IORING_CQE_F_MORE)) uring_wake_arm();
+        break;
+    case UD_RECV: uring_on_recv(UD_PTR(e->user_data), e); break;
+    case UD_SEND: uring_on_send(UD_PTR(e->user_data), e); break;
+    default: break;
+    }
+}
+
+/* on the reactor's thread: the ring is bound to its creator */
+static void uring_setup(void) {
+    self->ring = malloc(sizeof(*self->ring));
+    int rc = self->ring ? uring_init(self->ring, URING_ENTRIES) : -ENOMEM;
+    if (rc == 0) rc = uring_bufs_init(self->ring, &self->bufs, URING_GROUP, URING_BUFS, URING_BUF_SIZE);
+    if (rc == 0 && pool_init(&self->send_pool, sizeof(uring_send_t), 256) < 0) rc = -ENOMEM;
+    if (rc < 0) {
+        errno = -rc;
+        perror("io_uring_setup");
+        exit(1);
+    }
+    self->accept_timer.cb = uring_accept_retry;
+}
+
+static void uring_loop(void) {
+    uring_accept_arm();
+    uring_wake_arm();
+    int pending = 0;
+    for (;;) {
+        int timeout = tw_timeout_ms(&self->wheel, self->now_ms);
+        if (pending && (timeout < 0 || timeout > 1)) timeout = 1;
+        int rc = uring_wait(self->ring, timeout);
+        if (rc < 0 && rc != -ETIME && rc != -EINTR && rc != -EBUSY) {
+            errno = -rc;
+            perror("io_uring_enter");
+            exit(1);
+        }
+        self->now_ms = clock_ms();
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_cqe(self->ring))) {
+            struct io_uring_cqe e = *cqe; // the slot is the kernel's again once seen
+            uring_cqe_seen(self->ring);
+            uring_complete(&e);
+        }
+        tw_advance(&self->wheel, self->now_ms);
+        pending = loop_tail();
+    }
+}
+
+/* quiesced: no socket events and no timers until reactor_resume(), but mail
+ * is still handled (and its output flushed), so a reply or call already on
+ * its way between reactors lands before the state is read */
+static void park(void) {
+    atomic_store(&self->parked, 1);
+    while (atomic_load(&parking)) {
+        atomic_store(&self->busy, 1);
+        self->now_ms = clock_ms();
+        int handled = mail_drain();
+        int pending = loop_tail();
+        atomic_store(&self->spilled, pending);
+        if (handled) atomic_fetch_add(&self->parked_work, 1);
+        atomic_store(&self->busy, 0);
+        struct pollfd p = { .fd = self->evfd, .events = POLLIN };
+        poll(&p, 1, pending ? 1 : 10);
+    }
+    self->now_ms = clock_ms();
+    atomic_store(&self->parked, 0);
+}
+
+static uint64_t parked_work(void) {
+    uint64_t n = 0;
+    for (int i=0;i<nreactors;i++) n += atomic_load(&reactors[i].parked_work);
+    return n;
+}
+
+/* every reactor parked and idle with no mail anywhere. Mail is only created
+ * by handling mail, so two equal work counts around the scan (and busy
+ * checked after the inboxes) mean there was none in flight either. */
+static int reactors_settled(void) {
+    uint64_t before = parked_work();
+    for (int i=0;i<nreactors;i++)
+        if (!atomic_load(&reactors[i].parked) || atomic_load(&reactors[i].busy) || atomic_load(&reactors[i].spilled)) return 0;
+    for (int d=0;d<nreactors;d++)
+        for (int p=0;p<nreactors;p++) {
+            mailbox_t *mb = &reactors[d].inbox[p];
+            if (atomic_load(&mb->head) != atomic_load(&mb->tail)) return 0;
+        }
+    for (int i=0;i<nreactors;i++) if (atomic_load(&reactors[i].busy)) return 0;
+    return parked_work() == before;
+}
+
+static void wake_all(void) {
+    uint64_t one = 1;
+    for (int i=0;i<nreactors;i++)
+        if (write(reactors[i].evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            LOG(LOG_ERROR, "eventfd_write", " peer=%d err=%s", i, strerrorname_np(errno));
+}
+
+int reactor_quiesce(int timeout_ms) {
+    atomic_store(&parking, 1);
+    wake_all();
+    uint64_t deadline = clock_ms() + (uint64_t)timeout_ms;
+    struct timespec tick = { 0, 1000000 };
+    while (clock_ms() < deadline) {
+        if (reactors_settled()) return 0;
+        nanosleep(&tick, NULL);
+    }
+    reactor_resume();
+    return -1;
+}
+
+void reactor_resume(void) {
+    atomic_store(&parking, 0);
+    wake_all();
+}
+
+static void pin_to_core(int idx) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(idx % ncpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) LOG(LOG_WARN, "pin_failed", " cpu=%ld err=%s", idx % ncpu, strerrorname_np(err));
+}
+
+static void *reactor_main(void *arg) {
+    self = arg;
+    metrics_attach(self->idx);
+    if (nreactors > 1) pin_to_core(self->idx);
+
+    struct epoll_event events[MAX_EVENTS];
+    if (config.io == IO_URING) uring_setup();
+    self->now_ms = clock_ms();
+    tw_init(&self->wheel, self->now_ms);
+    if (start_hook) start_hook();
+    pthread_barrier_wait(&start_barrier);
+    self->now_ms = clock_ms();
+    if (self->ring) uring_loop(); // does not return
+    int pending = 0;
+    for (;;) {
+        int timeout = tw_timeout_ms(&self->wheel, self->now_ms);
+        if (pending && (timeout < 0 || timeout > 1)) timeout = 1; // poll again soon while a peer inbox is full
+        int n = epoll_wait(self->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            exit(1);
+        }
+        self->now_ms = clock_ms();
+        for (int i=0;i<n;i++) {
+            void *p = events[i].data.ptr;
+            if (p == NULL) accept_all();
+            else if (p == self) mail_drain();
+            else conn_on_event(p, events[i].events);
+        }
+        tw_advance(&self->wheel, self->now_ms);
+        pending = loop_tail();
+        if (atomic_load_explicit(&parking, memory_order_relaxed)) park();
+    }
+    return NULL;
+}
+
+static void reactor_setup(reactor_t *r, int idx, int listen_fd) {
+    r->idx = idx;
+    r->listen_fd = listen_fd;
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) { perror("epoll_create1"); exit(1); }
+    r->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->evfd < 0) { perror("eventfd"); exit(1); }
+    r->inbox = aligned_alloc(CACHELINE, sizeof(mailbox_t) * (size_t)nreactors);
+    if (!r->inbox) { perror("aligned_alloc"); exit(1); }
+    memset(r->inbox, 0, sizeof(mailbox_t) * (size_t)nreactors);
+    size_t prealloc = config.max_clients < POOL_PREALLOC_MAX ? (size_t)config.max_clients : POOL_PREALLOC_MAX;
+    if (pool_init(&r->client_pool, sizeof(client_t), prealloc) < 0 ||
+        pool_init(&r->rbuf_pool, RECV_BUF, prealloc / 4) < 0) { perror("pool_init"); exit(1); }
+
+    r->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (config.io == IO_URING) return; // its ring is set up by its own thread
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) { perror("epoll_ctl"); exit(1); }
+    ev.data.ptr = r;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->evfd, &ev) < 0) { perror("epoll_ctl"); exit(1); }
+}
+
+void reactor_init(int nworkers, const int *listen_fds) {
+    nreactors = nworkers;
+    reactors = calloc((size_t)nworkers, sizeof(reactor_t));
+    if (!reactors) { perror("calloc"); exit(1); }
+    /* every inbox must exist before any reactor can post to it */
+    for (int i=0;i<nworkers;i++) reactor_setup(&reactors[i], i, listen_fds[i]);
+}
+
+/* epoll only: hot restarts are not offered with io_uring (main() refuses the combination) */
+client_t *reactor_adopt(int idx, int fd, const char *pending, size_t len) {
+    reactor_t *r = &reactors[idx];
+    if (len > RECV_BUF) return NULL;
+    client_t *c = pool_get(&r->client_pool);
+    if (!c) return NULL;
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    if (len > 0) {
+        if (!(c->rbuf = pool_get(&r->rbuf_pool))) { pool_put(&r->client_pool, c); return NULL; }
+        memcpy(c->rbuf, pending, len);
+        c->rtail = (uint16_t)len;
+    }
+    /* same mask as accept_all; adding reports the socket's current readiness,
+     * so queued output is flushed and waiting input read on the first wait */
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG(LOG_ERROR, "epoll_add", " err=%s", strerrorname_np(errno));
+        if (c->rbuf) pool_put(&r->rbuf_pool, c->rbuf);
+        pool_put(&r->client_pool, c);
+        return NULL;
+    }
+    return c;
+}
+
+void reactor_start(void (*on_start)(void)) {
+    start_hook = on_start;
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)nreactors);
+    for (int i=1;i<nreactors;i++) {
+        if (pthread_create(&reactors[i].thread, NULL, reactor_main, &reactors[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    reactors[0].thread = pthread_self();
+    reactor_main(&reactors[0]);
+}
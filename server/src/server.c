@@ -1,9 +1,39 @@
 // server.c
 // Minimal TCP server skeleton for RPS bo9 project.
 // - accept connections
-// - parse simple line-based protocol (CRLF terminated)
-// - implement HELLO, LIST, CREATE, JOIN (basic)
-// - thread-per-client model, global mutex for rooms/clients
+// - parse simple line-based protocol (CRLF terminated); commands dispatch
+//   through a handler table generated from COMMANDS, constant replies are
+//   literals with their CRLF and the game's hot ones are built without printf
+// - implement HELLO, LIST, CREATE, JOIN, LEAVE and the bo9 match (READY/MOVE)
+// - epoll reactors (reactor.c) drive handle_line, one per --workers thread
+// - each reactor owns its clients table; one mutex per room, output is only
+//   queued under it (flushing happens in the reactor with no lock held)
+// - LIST replies come from a pre-serialized snapshot rebuilt only when rooms change;
+//   LIST OPEN / PREFIX / <offset> <limit> pages come from two name-ordered
+//   indexes (ostree.c) of all rooms and of OPEN ones, in O(log n + page)
+// - MOVE_TIMEOUT / RECONNECT_WINDOW run on one timer per room, KEEPALIVE on one
+//   per client, all on the reactors' timer wheels
+// - a dropped connection leaves a suspended session (session.c) that
+//   RECONNECT <token> reattaches, seat included if its game is paused
+// - capacities come from the command line; client and room slots are
+//   recycled through O(1) free stacks and room ids encode slot + generation
+// - SUBSCRIBE LOBBY clients get ROOM_ADDED/UPDATED/REMOVED deltas instead of
+//   polling LIST: changed rooms are queued, diffed once per LOBBY_BATCH_MS on
+//   reactor 0 and the batch is fanned out by reference to every subscriber
+// - QUEUE puts a client on a lock-free MPMC ring (matchq.h); whichever
+//   reactor's batch timer fires pairs the waiting players into a room that is
+//   already full and playing, so quick-match clients never race for JOIN
+// - counters and per-command latency histograms (metrics.c) are recorded on
+//   the hot path and scraped from --admin-port
+// - --journal PATH appends sessions, rooms, rounds and match results to a
+//   binary journal (journal.c) off the game path; a cold start replays it
+//   to rebuild the suspended sessions
+// - --handoff PATH: a new process started with the same PATH takes the
+//   listening sockets, connections, rooms and sessions over (handoff.c), so
+//   an upgrade restarts without dropping anyone
+// - --cluster / --node: rooms and sessions belong to the node that made them,
+//   named in the room id's low bits and the token's first char; other nodes
+//   answer REDIRECT for them and mirror every node's lobby (cluster.c)
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -17,276 +47,2365 @@
 #include <stdint.h>
 #include <sys/socket.h>
 #include <stdarg.h>
+#include <getopt.h>
+#include <stdatomic.h>
 
-#define LISTEN_BACKLOG 16
-#define LINE_BUF 512
-#define MAX_CLIENTS 128
-#define MAX_ROOMS 64
-#define NICK_MAX 32
-#define ROOM_NAME_MAX 64
+#include "server.h"
+#include "reactor.h"
+#include "snapshot.h"
+#include "game.h"
+#include "session.h"
+#include "token.h"
+#include "net.h"
+#include "log.h"
+#include "metrics.h"
+#include "ostree.h"
+#include "matchq.h"
+#include "handoff.h"
+#include "journal.h"
+#include "uring.h"
+#include "codec.h"
+#include "cluster.h"
 
-typedef enum { ST_CONNECTED, ST_AUTH, ST_IN_LOBBY, ST_IN_ROOM } client_state_t;
+#define MAX_ARGS 6       // LIST OPEN PREFIX <prefix> <offset> <limit>
+#define LIST_PAGE_MAX 100 // rooms per paged LIST reply
+#define ROOM_LINE_MAX (ROOM_NAME_MAX + 48) // one ROOM / ROOM_ADDED line
+#define MATCH_BATCH 64       // queue entries one matcher run looks at
+#define MATCH_RETRY_MS 1000  // out of rooms: how long paired players wait for another try
+#define WATCH_LAG_MAX 16384  // queued bytes past which a spectator misses ROUND_START / ROUND_RESULT
+#define WATCHERS_MAX 65536   // spectators per room
 
 typedef struct {
-    int id;
-    char name[ROOM_NAME_MAX+1];
-    int players[2]; // client_fds (or -1)
+    _Alignas(64) pthread_mutex_t lock; // guards every field below
+    atomic_int id; // 0 = free slot; written under lock, may be peeked without it
+    game_t game;   // match state, 8 bytes
+    client_ref_t players[2]; // or CLIENT_REF_NONE
     int player_count;
+    uint8_t pending;      // QUEUE match: bits of the seats not yet told about it
+    uint64_t deadline_ms; // 0 = none; MOVE_TIMEOUT while PLAYING, RECONNECT_WINDOW while PAUSED
+    /* cold: only needed when formatting */
+    char name[ROOM_NAME_MAX+1];
+    char nicks[2][NICK_MAX+1];
+    tw_timer_t timer; // only touched by reactor room_owner(); follows deadline_ms
+    client_ref_t *watchers; // WATCH spectators, unordered; kept when the slot is reused
+    uint32_t nwatchers, watchers_cap;
+    uint32_t slot;
+    uint32_t gen;     // bumped on every reuse of the slot, upper bits of the id
+    atomic_bool dirty; // queued for the next lobby batch
+    /* what subscribers were last told; lobby flusher (reactor LOBBY_REACTOR) only */
+    int pub_id;        // 0 = not announced
+    int pub_players;
+    room_state_t pub_state;
+    /* paged LIST entry; room_index_lock guards these */
+    ost_node_t by_name, open_by_name; // in room_index / open_index while listed
+    int ix_id, ix_players;            // copies, so a page is built without room locks
+    room_state_t ix_state;
 } room_t;
 
+/* O(1) slot allocator: recycled slots first (LIFO, still warm), then fresh ones */
 typedef struct {
-    int fd;
-    char nick[NICK_MAX+1];
-    char token[64];
-    client_state_t state;
-    int room_id; // -1 if none
-    time_t last_seen;
-    pthread_t thread;
-} client_t;
-
-static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
-static client_t *clients[MAX_CLIENTS];
-static room_t rooms[MAX_ROOMS];
-static int next_room_id = 1;
-
-/* utility: trim CRLF */
-static void trim_crlf(char *s) {
-    size_t n = strlen(s);
-    while (n>0 && (s[n-1] == '\r' || s[n-1] == '\n')) { s[n-1] = '\0'; n--; }
-}
-
-/* send a line (adds CRLF) */
-static int send_line(int fd, const char *fmt, ...) {
-    char buf[LINE_BUF];
+    uint32_t *free;
+    uint32_t nfree;
+    uint32_t used; // slots [0, used) have been handed out at least once
+    uint32_t cap;
+} slot_stack_t;
+
+/* one per reactor, touched only by that reactor */
+typedef struct {
+    client_t **slots;
+    slot_stack_t ids;
+    uint32_t gen;
+    _Atomic uint32_t *queued; // per slot: ticket a matcher may claim (swap to 0), 0 = none
+    _Atomic uint32_t *on_ring; // per slot: ticket of its entry still on the ring, 0 = none
+    uint32_t next_ticket;
+} client_table_t;
+
+/* rooms live in chunks allocated on first use and never moved or freed, so a
+ * room_t pointer stays valid without any lock */
+#define ROOM_CHUNK_BITS 10
+#define ROOM_CHUNK (1u << ROOM_CHUNK_BITS)
+
+server_config_t config = {
+    .workers = 1,
+    .max_clients = DEFAULT_MAX_CLIENTS,
+    .max_rooms = DEFAULT_MAX_ROOMS,
+    .backlog = DEFAULT_BACKLOG,
+    .cmd_rate = DEFAULT_CMD_RATE,
+};
+
+static pthread_mutex_t rooms_alloc_lock = PTHREAD_MUTEX_INITIALIZER; // room_slots and chunk allocation; taken after a room lock if both
+static client_table_t client_tables[MAX_WORKERS];
+static _Atomic(room_t *) *room_chunks; // config.max_rooms / ROOM_CHUNK entries, NULL until used
+static size_t nroom_chunks;
+static slot_stack_t room_slots;
+static int room_slot_bits;    // room id = (gen << room_slot_bits | slot) << cluster_node_bits | node
+static uint32_t room_gen_max; // gen runs 1..room_gen_max so ids stay positive ints
+
+/* LIST reply cache: ROOM_LIST + ROOM lines, tagged with the rooms_version it shows */
+static atomic_uint_fast64_t rooms_version = 1;
+static snapshot_slot_t room_list;
+static pthread_mutex_t room_list_lock = PTHREAD_MUTEX_INITIALIZER; // rebuilders only
+
+/* paged LIST: live rooms and OPEN rooms, each sorted by name */
+static pthread_mutex_t room_index_lock = PTHREAD_MUTEX_INITIALIZER; // a leaf lock, taken under room locks
+static ost_t room_index, open_index;
+
+/* lobby deltas: rooms changed since the last batch, each queued once (room_t::dirty) */
+#define LOBBY_REACTOR 0
+typedef struct {
+    uint32_t *slots;
+    size_t len, cap;
+} slot_vec_t;
+static pthread_mutex_t lobby_lock = PTHREAD_MUTEX_INITIALIZER; // guards lobby_dirty only; a leaf lock
+static slot_vec_t lobby_dirty;
+static atomic_int lobby_armed; // a batch is scheduled
+static tw_timer_t lobby_timer; // on reactor LOBBY_REACTOR
+static tw_timer_t cluster_timer; // same reactor, every LOBBY_BATCH_MS while clustered
+static client_t *lobby_subs[MAX_WORKERS]; // per reactor, touched only by that reactor
+static atomic_int lobby_nsubs[MAX_WORKERS];
+
+static void lobby_arm(uint64_t arg);
+
+/* QUEUE: entries of every reactor's waiting clients, stale ones included */
+static matchq_t matchq;
+static size_t matchq_cap;
+static atomic_size_t matchq_len; // entries pushed and not yet consumed; bounds the ring
+static tw_timer_t match_timers[MAX_WORKERS]; // one batch timer per reactor
+
+static int listen_fds[MAX_WORKERS]; // handed on at a hot restart
+
+static int room_name_cmp(const room_t *a, const room_t *b) {
+    int d = strcmp(a->name, b->name);
+    return d ? d : (a->slot > b->slot) - (a->slot < b->slot);
+}
+
+static int by_name_cmp(const ost_node_t *a, const ost_node_t *b) {
+    return room_name_cmp(ost_entry(a, room_t, by_name), ost_entry(b, room_t, by_name));
+}
+
+static int open_by_name_cmp(const ost_node_t *a, const ost_node_t *b) {
+    return room_name_cmp(ost_entry(a, room_t, open_by_name), ost_entry(b, room_t, open_by_name));
+}
+
+/* bring a locked room's index entries up to date. The name is only written
+ * while the room is unlisted, so the indexes may compare it under their own lock. */
+static void room_index_sync(room_t *r) {
+    int id = atomic_load_explicit(&r->id, memory_order_relaxed);
+    int open = id != 0 && r->game.state == ROOM_OPEN;
+    pthread_mutex_lock(&room_index_lock);
+    if (id != 0 && !ost_linked(&r->by_name)) ost_insert(&room_index, &r->by_name);
+    else if (id == 0 && ost_linked(&r->by_name)) ost_remove(&room_index, &r->by_name);
+    if (open && !ost_linked(&r->open_by_name)) ost_insert(&open_index, &r->open_by_name);
+    else if (!open && ost_linked(&r->open_by_name)) ost_remove(&open_index, &r->open_by_name);
+    r->ix_id = id;
+    r->ix_players = r->player_count;
+    r->ix_state = (room_state_t)r->game.state;
+    pthread_mutex_unlock(&room_index_lock);
+}
+
+/* call after any change of r visible in LIST; r locked */
+static void rooms_changed(room_t *r) {
+    room_index_sync(r);
+    atomic_fetch_add_explicit(&rooms_version, 1, memory_order_release);
+    if (atomic_exchange_explicit(&r->dirty, 1, memory_order_acq_rel)) return; // already queued
+    pthread_mutex_lock(&lobby_lock);
+    if (lobby_dirty.len == lobby_dirty.cap) {
+        size_t cap = lobby_dirty.cap ? lobby_dirty.cap * 2 : 64;
+        uint32_t *ns = realloc(lobby_dirty.slots, cap * sizeof(*ns));
+        if (!ns) {
+            pthread_mutex_unlock(&lobby_lock);
+            atomic_store_explicit(&r->dirty, 0, memory_order_relaxed); // try again on its next change
+            return;
+        }
+        lobby_dirty.slots = ns;
+        lobby_dirty.cap = cap;
+    }
+    lobby_dirty.slots[lobby_dirty.len++] = r->slot;
+    pthread_mutex_unlock(&lobby_lock);
+    if (!atomic_exchange_explicit(&lobby_armed, 1, memory_order_acq_rel)) reactor_call(LOBBY_REACTOR, lobby_arm, 0);
+}
+
+/* token view into the receive buffer; valid until handle_line returns */
+typedef struct {
+    const char *p;
+    size_t n;
+} tok_t;
+
+/* split on runs of spaces into at most max views; returns the count */
+static int tokenize(const char *s, size_t len, tok_t *out, int max) {
+    const char *end = s + len;
+    int n = 0;
+    while (n < max) {
+        while (s < end && *s == ' ') s++;
+        if (s == end) break;
+        const char *t = memchr(s, ' ', (size_t)(end - s));
+        if (!t) t = end;
+        out[n].p = s;
+        out[n].n = (size_t)(t - s);
+        n++;
+        s = t;
+    }
+    return n;
+}
+
+/* copy a view into a NUL-terminated field of cap bytes, truncating */
+static void tok_copy(char *dst, size_t cap, tok_t t) {
+    size_t n = t.n < cap - 1 ? t.n : cap - 1;
+    memcpy(dst, t.p, n);
+    dst[n] = '\0';
+}
+
+/* strict decimal parse; -1 if t is not a non-negative int */
+static int tok_to_int(tok_t t) {
+    if (t.n == 0 || t.n > 10) return -1;
+    int64_t v = 0;
+    for (size_t i=0;i<t.n;i++) {
+        if (t.p[i] < '0' || t.p[i] > '9') return -1;
+        v = v*10 + (t.p[i] - '0');
+    }
+    return v <= INT32_MAX ? (int)v : -1;
+}
+
+static int tok_is(tok_t t, const char *lit) {
+    size_t n = strlen(lit);
+    return t.n == n && memcmp(t.p, lit, n) == 0;
+}
+
+/* every command as X(word, handler): cmd_t, the metric labels and the
+ * dispatch table are all generated from this list, lookup_cmd maps words */
+#define COMMANDS(X) \
+    X(HELLO, hello) X(LIST, list) X(CREATE, create) X(JOIN, join) X(LEAVE, leave) \
+    X(READY, ready) X(MOVE, move) X(QUIT, quit) X(PING, ping) X(RECONNECT, reconnect) \
+    X(SUBSCRIBE, subscribe) X(UNSUBSCRIBE, unsubscribe) X(QUEUE, queue) X(UNQUEUE, unqueue) \
+    X(WATCH, watch) X(UNWATCH, unwatch)
+
+typedef enum {
+    CMD_UNKNOWN,
+#define X(word, fn) CMD_##word,
+    COMMANDS(X)
+#undef X
+    CMD_COUNT
+} cmd_t;
+
+/* metric labels, indexed by cmd_t */
+static const char *const cmd_names[CMD_COUNT] = {
+    [CMD_UNKNOWN] = "unknown",
+#define X(word, fn) [CMD_##word] = #word,
+    COMMANDS(X)
+#undef X
+};
+_Static_assert(CMD_COUNT <= METRICS_MAX_CMDS, "one command histogram each");
+
+/* command word -> id: switch on length and first byte, one memcmp to confirm */
+static cmd_t lookup_cmd(tok_t w) {
+#define CMD_IS(lit, id) (memcmp(w.p, lit, sizeof(lit)-1) == 0 ? id : CMD_UNKNOWN)
+    switch (w.n) {
+    case 4:
+        switch (w.p[0]) {
+        case 'L': return CMD_IS("LIST", CMD_LIST);
+        case 'J': return CMD_IS("JOIN", CMD_JOIN);
+        case 'M': return CMD_IS("MOVE", CMD_MOVE);
+        case 'P': return CMD_IS("PING", CMD_PING);
+        case 'Q': return CMD_IS("QUIT", CMD_QUIT);
+        }
+        break;
+    case 5:
+        switch (w.p[0]) {
+        case 'H': return CMD_IS("HELLO", CMD_HELLO);
+        case 'L': return CMD_IS("LEAVE", CMD_LEAVE);
+        case 'R': return CMD_IS("READY", CMD_READY);
+        case 'Q': return CMD_IS("QUEUE", CMD_QUEUE);
+        case 'W': return CMD_IS("WATCH", CMD_WATCH);
+        }
+        break;
+    case 6: return CMD_IS("CREATE", CMD_CREATE);
+    case 7:
+        switch (w.p[2]) {
+        case 'Q': return CMD_IS("UNQUEUE", CMD_UNQUEUE);
+        case 'W': return CMD_IS("UNWATCH", CMD_UNWATCH);
+        }
+        break;
+    case 9:
+        switch (w.p[0]) {
+        case 'R': return CMD_IS("RECONNECT", CMD_RECONNECT);
+        case 'S': return CMD_IS("SUBSCRIBE", CMD_SUBSCRIBE);
+        }
+        break;
+    case 11: return CMD_IS("UNSUBSCRIBE", CMD_UNSUBSCRIBE);
+    }
+    return CMD_UNKNOWN;
+#undef CMD_IS
+}
+
+/* decimal form of v; buf holds 20 digits. Also the number fields of frames. */
+static size_t u64_to_dec(char *buf, uint64_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    for (size_t i=0;i<n;i++) buf[i] = tmp[n-1-i];
+    return n;
+}
+
+/* printf-free pieces of a reply: each writes at p and returns the end */
+static char *put_mem(char *p, const char *s, size_t n) {
+    memcpy(p, s, n);
+    return p + n;
+}
+#define put_lit(p, lit) put_mem(p, lit, sizeof(lit) - 1)
+
+static char *put_uint(char *p, uint64_t v) {
+    return p + u64_to_dec(p, v);
+}
+
+/* vsnprintf into buf (LINE_BUF bytes) and terminate with CRLF; returns the length */
+static size_t format_line(char *buf, const char *fmt, va_list ap) {
+    int n = vsnprintf(buf, LINE_BUF - 2, fmt, ap);
+    size_t len = n < 0 ? 0 : ((size_t)n < LINE_BUF - 2 ? (size_t)n : LINE_BUF - 3);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return len;
+}
+
+/* queue a line (adds CRLF), formatted straight into the client's output queue */
+static int send_line(client_t *c, const char *fmt, ...) {
+    uint64_t t0 = metrics_now_ns();
+    char *buf = conn_reserve(c, LINE_BUF);
+    if (!buf) return -1;
     va_list ap;
     va_start(ap, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, ap);
+    conn_commit(c, format_line(buf, fmt, ap));
     va_end(ap);
-    strncat(buf, "\r\n", sizeof(buf)-strlen(buf)-1);
-    size_t to_write = strlen(buf);
-    ssize_t written = send(fd, buf, to_write, 0);
-    return (written == (ssize_t)to_write) ? 0 : -1;
+    metrics_add(MET_LINES_OUT, 1);
+    metrics_record(MET_OP_SEND, metrics_now_ns() - t0);
+    return 0;
 }
 
-/* generate simple token */
-static void gen_token(char *out, size_t outlen) {
-    const char *hex = "0123456789abcdef";
-    srand((unsigned)time(NULL) ^ (uintptr_t)pthread_self());
-    for (size_t i=0;i<30 && i+1<outlen;i++) out[i] = hex[rand() % 16];
-    out[30 < outlen ? 30 : outlen-1] = '\0';
+/* queue a line that is ready to go, CRLF included */
+static int send_bytes(client_t *c, const char *line, size_t n) {
+    uint64_t t0 = metrics_now_ns();
+    char *buf = conn_reserve(c, n);
+    if (!buf) return -1;
+    memcpy(buf, line, n);
+    conn_commit(c, n);
+    metrics_add(MET_LINES_OUT, 1);
+    metrics_record(MET_OP_SEND, metrics_now_ns() - t0);
+    return 0;
 }
 
-/* find free client slot */
-static int register_client(client_t *c) {
-    pthread_mutex_lock(&global_lock);
-    for (int i=0;i<MAX_CLIENTS;i++) {
-        if (clients[i] == NULL) {
-            clients[i] = c;
-            pthread_mutex_unlock(&global_lock);
-            return 0;
-        }
+/* constant replies: the literal and its CRLF are laid out at compile time */
+#define send_lit(c, lit) send_bytes(c, lit "\r\n", sizeof(lit "\r\n") - 1)
+
+/* "<word> <v>": ROOM_CREATED, ROOM_JOINED, ROUND_START */
+#define send_word_uint(c, lit, v) send_word_num(c, lit " ", sizeof(lit " ") - 1, v)
+static int send_word_num(client_t *c, const char *word, size_t n, uint64_t v) {
+    char line[64];
+    char *p = put_uint(put_mem(line, word, n), v);
+    p = put_lit(p, "\r\n");
+    return send_bytes(c, line, (size_t)(p - line));
+}
+
+/* answer with ERR 200 and close once it is flushed: the client floods or keeps sending garbage */
+static void abuse_close(client_t *c, const char *why) {
+    LOG(LOG_WARN, "abusive_client", " fd=%d nick=%s reason=%s", c->fd, c->state >= ST_AUTH ? c->nick : "-", why);
+    metrics_add(MET_ABUSE, 1);
+    send_lit(c, "ERR 200 TOO_MANY_INVALID_MSGS");
+    c->closing = 1; // no further line of it is handled
+}
+
+/* ERR 100; more than INVALID_MAX of them within INVALID_WINDOW_MS end the connection */
+static void bad_format(client_t *c, const char *why) {
+    send_line(c, "ERR 100 BAD_FORMAT %s", why);
+    uint64_t now = reactor_now_ms();
+    if (now - c->invalid_since_ms >= INVALID_WINDOW_MS) {
+        c->invalid_since_ms = now;
+        c->invalid = 0;
+    }
+    if (++c->invalid > INVALID_MAX) abuse_close(c, "invalid");
+}
+
+/* the room or session the client asked for lives on another node */
+static void send_redirect(client_t *c, int node) {
+    const cluster_node_t *n = cluster_node(node);
+    metrics_add(MET_REDIRECTS, 1);
+    send_line(c, "REDIRECT %s %d", n->host, n->port);
+}
+
+/* token bucket as a virtual clock (GCRA) in units of 1/cmd_rate ms: each command
+ * moves rate_tat 1000 on, and one that would put it more than a burst ahead of
+ * the reactor clock is over the rate. No syscall: the clock is the loop's. */
+static int rate_admit(client_t *c) {
+    if (config.cmd_rate == 0) return 1;
+    uint64_t now = reactor_now_ms() * (uint64_t)config.cmd_rate;
+    uint64_t tat = c->rate_tat > now ? c->rate_tat : now;
+    if (tat - now > ((uint64_t)config.cmd_rate * CMD_BURST_S - 1) * 1000) return 0;
+    c->rate_tat = tat + 1000;
+    return 1;
+}
+
+static snapshot_t *format_shared(const char *fmt, va_list ap) {
+    snapshot_t *s = snapshot_alloc(LINE_BUF);
+    if (s) s->len = format_line(s->data, fmt, ap);
+    return s;
+}
+
+/* queue s for the spectators of a locked room. lossy: one that lags behind
+ * by more than WATCH_LAG_MAX misses it; ROUND_RESULT carries the whole
+ * score, so the next one it gets catches it up */
+static void watchers_send(const room_t *r, snapshot_t *s, int lossy) {
+    for (uint32_t i=0;i<r->nwatchers;i++) client_send_lossy(r->watchers[i], s, lossy ? WATCH_LAG_MAX : SIZE_MAX);
+    metrics_add(MET_LINES_OUT, r->nwatchers);
+}
+
+/* queue one shared line for every occupied seat and spectator of a locked
+ * room, recipients on other reactors get a reference, not a copy; takes
+ * the caller's reference. lossy as in watchers_send. */
+static void room_send_shared(room_t *r, int lossy, snapshot_t *s, uint64_t t0) {
+    for (int i=0;i<2;i++) {
+        if (r->players[i] == CLIENT_REF_NONE) continue;
+        client_send_shared(r->players[i], s);
+        metrics_add(MET_LINES_OUT, 1);
+    }
+    watchers_send(r, s, lossy);
+    snapshot_put(s);
+    metrics_record(MET_OP_SEND, metrics_now_ns() - t0);
+}
+
+/* format once into a shared buffer for room_send_shared */
+static void room_broadcast(room_t *r, int lossy, const char *fmt, ...) {
+    uint64_t t0 = metrics_now_ns();
+    va_list ap;
+    va_start(ap, fmt);
+    snapshot_t *s = format_shared(fmt, ap);
+    va_end(ap);
+    if (s) room_send_shared(r, lossy, s, t0);
+}
+
+/* room_broadcast of a line that is ready to go, CRLF included */
+static void room_broadcast_bytes(room_t *r, int lossy, const char *line, size_t n) {
+    uint64_t t0 = metrics_now_ns();
+    snapshot_t *s = snapshot_alloc(n);
+    if (!s) return;
+    memcpy(s->data, line, n);
+    s->len = n;
+    room_send_shared(r, lossy, s, t0);
+}
+#define room_broadcast_lit(r, lossy, lit) room_broadcast_bytes(r, lossy, lit "\r\n", sizeof(lit "\r\n") - 1)
+
+static void room_broadcast_round(room_t *r, int lossy) {
+    char line[32];
+    char *p = put_uint(put_lit(line, "ROUND_START "), (uint64_t)r->game.round);
+    p = put_lit(p, "\r\n");
+    room_broadcast_bytes(r, lossy, line, (size_t)(p - line));
+}
+
+/* ROUND_RESULT <WINNER nick|DRAW> <m1> <m2> <s1> <s2> CRLF into buf (LINE_BUF bytes); its length */
+static size_t round_result_line(char *buf, const room_t *r, round_winner_t w, char m0, char m1) {
+    char *p = put_lit(buf, "ROUND_RESULT ");
+    if (w == ROUND_DRAW) {
+        p = put_lit(p, "DRAW ");
+    } else {
+        const char *nick = r->nicks[w == ROUND_SEAT1];
+        p = put_lit(p, "WINNER ");
+        p = put_mem(p, nick, strlen(nick));
+        *p++ = ' ';
     }
-    pthread_mutex_unlock(&global_lock);
+    *p++ = m0;
+    *p++ = ' ';
+    *p++ = m1;
+    *p++ = ' ';
+    p = put_uint(p, (uint64_t)r->game.score[0]);
+    *p++ = ' ';
+    p = put_uint(p, (uint64_t)r->game.score[1]);
+    p = put_lit(p, "\r\n");
+    return (size_t)(p - buf);
+}
+
+/* a seat event of a locked room: the line for the other seat (if to is not
+ * CLIENT_REF_NONE), which every spectator gets as well */
+static void room_announce(room_t *r, client_ref_t to, const char *fmt, ...) {
+    uint64_t t0 = metrics_now_ns();
+    va_list ap;
+    va_start(ap, fmt);
+    snapshot_t *s = format_shared(fmt, ap);
+    va_end(ap);
+    if (!s) return;
+    if (to != CLIENT_REF_NONE) {
+        client_send_shared(to, s);
+        metrics_add(MET_LINES_OUT, 1);
+    }
+    watchers_send(r, s, 0);
+    snapshot_put(s);
+    metrics_record(MET_OP_SEND, metrics_now_ns() - t0);
+}
+
+static uint64_t realtime_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void journal_session(journal_type_t type, const client_t *c) {
+    j_session_t j;
+    memcpy(j.token, c->token, sizeof(j.token));
+    memcpy(j.nick, c->nick, sizeof(j.nick));
+    journal_append(type, &j, sizeof(j));
+}
+
+static void journal_room(journal_type_t type, int id, const char *name) {
+    j_room_t j = { .room_id = id };
+    memcpy(j.name, name, strnlen(name, ROOM_NAME_MAX)); // j is zeroed: stays terminated
+    journal_append(type, &j, sizeof(j));
+}
+
+/* a locked room's game just ended */
+static void journal_match(const room_t *r, int winner, j_end_reason_t reason) {
+    j_match_t j = {
+        .room_id = atomic_load_explicit(&r->id, memory_order_relaxed), .rounds = r->game.round,
+        .winner = (uint8_t)winner, .reason = (uint8_t)reason, .score = { r->game.score[0], r->game.score[1] },
+    };
+    memcpy(j.nicks, r->nicks, sizeof(j.nicks));
+    journal_append(J_MATCH_END, &j, sizeof(j));
+}
+
+static int slot_stack_init(slot_stack_t *s, uint32_t cap) {
+    s->free = malloc(sizeof(*s->free) * cap);
+    s->nfree = s->used = 0;
+    s->cap = cap;
+    return s->free ? 0 : -1;
+}
+
+static int slot_get(slot_stack_t *s) {
+    if (s->nfree > 0) return (int)s->free[--s->nfree];
+    if (s->used < s->cap) return (int)s->used++;
     return -1;
 }
 
+static void slot_put(slot_stack_t *s, int slot) {
+    s->free[s->nfree++] = (uint32_t)slot;
+}
+
+/* take a free slot in the calling reactor's table */
+static int register_client(client_t *c) {
+    int r = reactor_index();
+    client_table_t *t = &client_tables[r];
+    int slot = slot_get(&t->ids);
+    if (slot < 0) return -1;
+    if (++t->gen == 0) t->gen = 1;
+    c->ref = CLIENT_REF(t->gen, r, slot);
+    t->slots[slot] = c;
+    return 0;
+}
+
 static void unregister_client(client_t *c) {
-    pthread_mutex_lock(&global_lock);
-    for (int i=0;i<MAX_CLIENTS;i++) {
-        if (clients[i] == c) {
-            clients[i] = NULL;
-            break;
-        }
-    }
-    pthread_mutex_unlock(&global_lock);
+    client_table_t *t = &client_tables[REF_REACTOR(c->ref)];
+    t->slots[REF_SLOT(c->ref)] = NULL;
+    slot_put(&t->ids, REF_SLOT(c->ref));
 }
 
-/* find room by id */
-static room_t* find_room_by_id(int id) {
-    for (int i=0;i<MAX_ROOMS;i++) {
-        if (rooms[i].id == id) return &rooms[i];
+/* resolve a ref owned by the calling reactor; NULL if stale or foreign */
+client_t *client_lookup(client_ref_t ref) {
+    int r = REF_REACTOR(ref), slot = REF_SLOT(ref);
+    if (r != reactor_index()) return NULL;
+    client_table_t *t = &client_tables[r];
+    if ((uint32_t)slot >= t->ids.used) return NULL;
+    client_t *c = t->slots[slot];
+    return (c && c->ref == ref) ? c : NULL;
+}
+
+/* room in a slot, NULL if its chunk was never allocated */
+static room_t *room_at(uint32_t slot) {
+    if ((slot >> ROOM_CHUNK_BITS) >= nroom_chunks) return NULL;
+    room_t *chunk = atomic_load_explicit(&room_chunks[slot >> ROOM_CHUNK_BITS], memory_order_acquire);
+    return chunk ? &chunk[slot & (ROOM_CHUNK - 1)] : NULL;
+}
+
+static void room_timer_fired(tw_timer_t *t);
+
+/* make sure slot's chunk exists; rooms_alloc_lock held */
+static room_t *room_chunk_alloc(uint32_t slot) {
+    room_t *r = room_at(slot);
+    if (r) return r;
+    room_t *chunk = aligned_alloc(_Alignof(room_t), sizeof(room_t) * ROOM_CHUNK);
+    if (!chunk) return NULL;
+    memset(chunk, 0, sizeof(room_t) * ROOM_CHUNK);
+    uint32_t base = slot & ~(ROOM_CHUNK - 1);
+    for (uint32_t i=0;i<ROOM_CHUNK;i++) {
+        pthread_mutex_init(&chunk[i].lock, NULL);
+        atomic_init(&chunk[i].id, 0);
+        chunk[i].timer.cb = room_timer_fired;
+        chunk[i].slot = base + i;
     }
+    atomic_store_explicit(&room_chunks[slot >> ROOM_CHUNK_BITS], chunk, memory_order_release);
+    return &chunk[slot & (ROOM_CHUNK - 1)];
+}
+
+static uint32_t room_id_slot(int id) {
+    return ((uint32_t)id >> cluster_node_bits) & ((1u << room_slot_bits) - 1);
+}
+
+/* find room by id and return it locked; NULL if there is none. The id names
+ * the slot, the generation bits reject ids of rooms that are gone. */
+static room_t* lock_room_by_id(int id) {
+    if (id <= 0) return NULL;
+    room_t *r = room_at(room_id_slot(id));
+    if (!r || atomic_load_explicit(&r->id, memory_order_relaxed) != id) return NULL;
+    pthread_mutex_lock(&r->lock);
+    if (atomic_load_explicit(&r->id, memory_order_relaxed) == id) return r;
+    pthread_mutex_unlock(&r->lock); // freed or reused meanwhile
     return NULL;
 }
 
+/* take a free slot for an empty OPEN room and return it locked, NULL if
+ * the table is full. The caller finishes with rooms_changed() and unlocks. */
+static room_t *open_room(const char *name) {
+    pthread_mutex_lock(&rooms_alloc_lock);
+    int slot = slot_get(&room_slots);
+    room_t *r = slot < 0 ? NULL : room_chunk_alloc((uint32_t)slot);
+    if (!r) {
+        if (slot >= 0) slot_put(&room_slots, slot);
+        pthread_mutex_unlock(&rooms_alloc_lock);
+        return NULL;
+    }
+    pthread_mutex_unlock(&rooms_alloc_lock);
+    pthread_mutex_lock(&r->lock); // the slot is ours; its last user may still be unlocking
+    r->gen = r->gen % room_gen_max + 1;
+    int id = (int)((r->gen << room_slot_bits | r->slot) << cluster_node_bits | (uint32_t)cluster_self);
+    strncpy(r->name, name, ROOM_NAME_MAX);
+    r->name[ROOM_NAME_MAX] = '\0';
+    r->players[0] = r->players[1] = CLIENT_REF_NONE;
+    r->player_count = 0;
+    r->pending = 0;
+    game_reset(&r->game);
+    atomic_store_explicit(&r->id, id, memory_order_relaxed);
+    metrics_add(MET_ROOMS_CREATED, 1);
+    journal_room(J_ROOM_OPEN, id, r->name);
+    return r;
+}
+
 /* create room */
 static int create_room(const char *name) {
-    pthread_mutex_lock(&global_lock);
-    for (int i=0;i<MAX_ROOMS;i++) {
-        if (rooms[i].id == 0) {
-            rooms[i].id = next_room_id++;
-            strncpy(rooms[i].name, name, ROOM_NAME_MAX);
-            rooms[i].name[ROOM_NAME_MAX] = '\0';
-            rooms[i].players[0] = rooms[i].players[1] = -1;
-            rooms[i].player_count = 0;
-            int id = rooms[i].id;
-            pthread_mutex_unlock(&global_lock);
-            return id;
-        }
+    room_t *r = open_room(name);
+    if (!r) return -1;
+    int id = atomic_load_explicit(&r->id, memory_order_relaxed);
+    rooms_changed(r);
+    pthread_mutex_unlock(&r->lock);
+    return id;
+}
+
+/* the reactor whose wheel holds a room's timer */
+static int room_owner(const room_t *r) {
+    return (int)(r->slot % (uint32_t)reactor_count());
+}
+
+/* owner side: make the wheel match deadline_ms */
+static void room_timer_sync(uint64_t slot) {
+    room_t *r = room_at((uint32_t)slot);
+    pthread_mutex_lock(&r->lock);
+    uint64_t now = reactor_now_ms();
+    if (r->deadline_ms == 0) reactor_timer_cancel(&r->timer);
+    else reactor_timer_arm(&r->timer, r->deadline_ms > now ? r->deadline_ms - now : 0);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* (re)start a locked room's timer, or stop it with delay_ms 0. Any reactor may
+ * call this; the owner re-arms its wheel on its next mailbox drain. */
+static void room_set_deadline(room_t *r, uint64_t delay_ms) {
+    r->deadline_ms = delay_ms ? reactor_now_ms() + delay_ms : 0;
+    reactor_call(room_owner(r), room_timer_sync, r->slot);
+}
+
+/* add a spectator to a locked room; -1 if it is full or out of memory */
+static int watch_add(room_t *r, client_ref_t ref) {
+    if (r->nwatchers == r->watchers_cap) {
+        if (r->watchers_cap >= WATCHERS_MAX) return -1;
+        uint32_t cap = r->watchers_cap ? r->watchers_cap * 2 : 8;
+        client_ref_t *w = realloc(r->watchers, cap * sizeof(*w));
+        if (!w) return -1;
+        r->watchers = w;
+        r->watchers_cap = cap;
     }
-    pthread_mutex_unlock(&global_lock);
-    return -1;
+    r->watchers[r->nwatchers++] = ref;
+    return 0;
 }
 
-/* list rooms: caller must hold no locks */
-static int send_room_list(int fd) {
-    pthread_mutex_lock(&global_lock);
-    int count = 0;
-    for (int i=0;i<MAX_ROOMS;i++) if (rooms[i].id != 0) count++;
-    send_line(fd, "ROOM_LIST %d", count);
-    for (int i=0;i<MAX_ROOMS;i++) {
-        if (rooms[i].id == 0) continue;
-        send_line(fd, "ROOM %d %s %d/2 %s", rooms[i].id, rooms[i].name, rooms[i].player_count,
-                  (rooms[i].player_count==2) ? "PLAYING" : "OPEN");
-    }
-    pthread_mutex_unlock(&global_lock);
+/* drop a spectator of a locked room; a scan, but over a dense array and only on UNWATCH or disconnect */
+static void watch_remove(room_t *r, client_ref_t ref) {
+    for (uint32_t i=0;i<r->nwatchers;i++) {
+        if (r->watchers[i] != ref) continue;
+        r->watchers[i] = r->watchers[--r->nwatchers];
+        return;
+    }
+}
+
+/* stop spectating; -1 if c was not (or its room has closed since) */
+static int unwatch(client_t *c) {
+    if (!c->watch_room) return -1;
+    room_t *r = lock_room_by_id(c->watch_room);
+    c->watch_room = 0;
+    if (!r) return -1;
+    watch_remove(r, c->ref);
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+/* whether c spectates a room that is still open; forgets a closed one */
+static int watching(client_t *c) {
+    if (!c->watch_room) return 0;
+    room_t *r = room_at(room_id_slot(c->watch_room));
+    if (r && atomic_load_explicit(&r->id, memory_order_relaxed) == c->watch_room) return 1;
+    c->watch_room = 0;
     return 0;
 }
 
-/* parse a single line and handle */
-static void handle_line(client_t *c, char *line) {
-    trim_crlf(line);
-    if (strlen(line) == 0) return;
-    // tokenize
-    char *cmd = strtok(line, " ");
-    if (!cmd) return;
-    if (strcmp(cmd, "HELLO") == 0) {
-        char *nick = strtok(NULL, " ");
-        if (!nick) { send_line(c->fd, "ERR 100 BAD_FORMAT missing_nick"); return; }
-        strncpy(c->nick, nick, NICK_MAX);
-        c->nick[NICK_MAX] = '\0';
-        gen_token(c->token, sizeof(c->token));
-        c->state = ST_AUTH;
-        send_line(c->fd, "WELCOME %s", c->token);
+/* free a locked room's slot; its players fall back to the lobby, its spectators are told */
+static void release_room(room_t *r) {
+    int id = atomic_load_explicit(&r->id, memory_order_relaxed);
+    journal_room(J_ROOM_CLOSE, id, "");
+    if (r->nwatchers) {
+        room_announce(r, CLIENT_REF_NONE, "WATCH_END %d", id);
+        r->nwatchers = 0;
+    }
+    if (r->deadline_ms) room_set_deadline(r, 0);
+    r->players[0] = r->players[1] = CLIENT_REF_NONE;
+    r->player_count = 0;
+    game_reset(&r->game);
+    atomic_store_explicit(&r->id, 0, memory_order_relaxed);
+    pthread_mutex_lock(&rooms_alloc_lock); // nests inside a room lock, never the other way round
+    slot_put(&room_slots, (int)r->slot);
+    pthread_mutex_unlock(&rooms_alloc_lock);
+    metrics_add(MET_ROOMS_RELEASED, 1);
+    rooms_changed(r);
+}
+
+/* lock the room c is seated in and find its seat. client_t::room_id is only a
+ * hint (a game may have ended on another reactor), so a stale one sends c
+ * back to the lobby and returns NULL. */
+static room_t *lock_client_room(client_t *c, int *seat) {
+    if (c->room_id < 0) return NULL;
+    room_t *r = lock_room_by_id(c->room_id);
+    if (r) {
+        for (int i=0;i<2;i++) if (r->players[i] == c->ref) { *seat = i; return r; }
+        pthread_mutex_unlock(&r->lock);
+    }
+    c->room_id = -1;
+    c->state = ST_AUTH;
+    return NULL;
+}
+
+/* both moves are in (or MOVE_TIMEOUT hit, a missing one shows as '-'):
+ * announce the result, then the next round or the end */
+static void finish_round(room_t *r) {
+    game_t *g = &r->game;
+    char m0 = move_char(g->move[0]), m1 = move_char(g->move[1]);
+    j_round_t jr = { .room_id = atomic_load_explicit(&r->id, memory_order_relaxed), .round = g->round, .move = { m0, m1 } };
+    round_winner_t w = game_resolve(g);
+    jr.score[0] = g->score[0];
+    jr.score[1] = g->score[1];
+    journal_append(J_ROUND, &jr, sizeof(jr));
+    char line[LINE_BUF];
+    room_broadcast_bytes(r, 1, line, round_result_line(line, r, w, m0, m1));
+    if (g->state == ROOM_FINISHED) {
+        room_broadcast(r, 0, "GAME_END %s", r->nicks[g->score[1] > g->score[0]]);
+        journal_match(r, g->score[1] > g->score[0], J_END_WON);
+        release_room(r);
         return;
-    } else if (strcmp(cmd, "LIST") == 0) {
-        if (c->state < ST_AUTH) { send_line(c->fd, "ERR 101 INVALID_STATE not_auth"); return; }
-        send_room_list(c->fd);
+    }
+    room_broadcast_round(r, 1);
+    room_set_deadline(r, MOVE_TIMEOUT_MS);
+}
+
+/* RECONNECT_WINDOW is over: the away seat loses by default */
+static void abandon_game(room_t *r) {
+    int away = game_away_seat(&r->game);
+    int winner = game_forfeit(&r->game, away);
+    client_ref_t other = r->players[winner];
+    room_announce(r, other, "PLAYER_UNAVAILABLE %s long", r->nicks[away]);
+    room_announce(r, other, "GAME_END %s", r->nicks[winner]);
+    journal_match(r, winner, J_END_ABANDONED);
+    release_room(r);
+}
+
+/* wheel callback on room_owner(): MOVE_TIMEOUT or RECONNECT_WINDOW expired */
+static void room_timer_fired(tw_timer_t *t) {
+    room_t *r = tw_entry(t, room_t, timer);
+    pthread_mutex_lock(&r->lock);
+    uint64_t now = reactor_now_ms();
+    if (atomic_load_explicit(&r->id, memory_order_relaxed) == 0 || r->deadline_ms == 0) {
+        pthread_mutex_unlock(&r->lock); // cancelled, a sync is on its way
         return;
-    } else if (strcmp(cmd, "CREATE") == 0) {
-        if (c->state < ST_AUTH) { send_line(c->fd, "ERR 101 INVALID_STATE"); return; }
-        char *rname = strtok(NULL, " ");
-        if (!rname) { send_line(c->fd, "ERR 100 BAD_FORMAT missing_room_name"); return; }
-        int rid = create_room(rname);
-        if (rid < 0) { send_line(c->fd, "ERR 200 SERVER_FULL"); return; }
-        send_line(c->fd, "ROOM_CREATED %d", rid);
+    }
+    if (now < r->deadline_ms) { // deadline moved meanwhile
+        reactor_timer_arm(t, r->deadline_ms - now);
+        pthread_mutex_unlock(&r->lock);
         return;
-    } else if (strcmp(cmd, "JOIN") == 0) {
-        char *idstr = strtok(NULL, " ");
-        if (!idstr) { send_line(c->fd, "ERR 100 BAD_FORMAT missing_room_id"); return; }
-        int rid = atoi(idstr);
-        pthread_mutex_lock(&global_lock);
-        room_t *r = find_room_by_id(rid);
-        if (!r) {
-            pthread_mutex_unlock(&global_lock);
-            send_line(c->fd, "ERR 104 UNKNOWN_ROOM");
-            return;
+    }
+    r->deadline_ms = 0;
+    if (r->game.state == ROOM_PLAYING) finish_round(r);
+    else if (r->game.state == ROOM_PAUSED) abandon_game(r);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* empty a seat of a locked room; a running game is forfeited */
+static void vacate_seat(room_t *r, int seat) {
+    r->players[seat] = CLIENT_REF_NONE;
+    r->player_count--;
+    client_ref_t other = r->players[1-seat];
+    room_announce(r, other, "PLAYER_LEFT %s", r->nicks[seat]);
+    int winner = game_forfeit(&r->game, seat);
+    if (winner >= 0) {
+        room_announce(r, other, "GAME_END %s", r->nicks[winner]);
+        journal_match(r, winner, J_END_FORFEIT);
+        release_room(r);
+    } else if (r->player_count == 0) {
+        release_room(r);
+    } else {
+        game_seated(&r->game, r->player_count);
+        rooms_changed(r);
+    }
+}
+
+/* take c out of its room (LEAVE or disconnect); a running game is forfeited.
+ * -1 if c was not seated anywhere */
+static int leave_room(client_t *c) {
+    int seat;
+    room_t *r = lock_client_room(c, &seat);
+    c->room_id = -1;
+    c->state = ST_AUTH;
+    if (!r) return -1;
+    vacate_seat(r, seat);
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+/* c's connection is going away mid-game: pause the game and keep its seat
+ * for RECONNECT_WINDOW instead of forfeiting. Returns the room id holding the
+ * seat, 0 if c had no game running. */
+static int suspend_seat(client_t *c, int *seat) {
+    room_t *r = lock_client_room(c, seat);
+    if (!r) return 0;
+    int rc = game_pause(&r->game, *seat);
+    if (rc < 0) { pthread_mutex_unlock(&r->lock); return 0; } // no game: closing just leaves the room
+    int rid = c->room_id;
+    c->room_id = -1; // detach, so leave_room does not forfeit the seat
+    c->state = ST_AUTH;
+    if (rc == 1) {
+        client_ref_t other = r->players[1-*seat];
+        room_announce(r, other, "PLAYER_UNAVAILABLE %s short", r->nicks[*seat]);
+        room_set_deadline(r, RECONNECT_WINDOW_MS);
+        rooms_changed(r);
+    } else {
+        release_room(r); // the other seat was already away: nobody is left to play
+        rid = 0;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return rid;
+}
+
+/* keep an authenticated session that lost its connection for RECONNECT */
+static void suspend_session(client_t *c) {
+    session_t s;
+    memcpy(s.token, c->token, sizeof(s.token));
+    memcpy(s.nick, c->nick, sizeof(s.nick));
+    s.seat = -1;
+    s.room_id = suspend_seat(c, &s.seat);
+    s.expires_ms = reactor_now_ms() + RECONNECT_WINDOW_MS;
+    if (session_put(&s, reactor_now_ms()) < 0) {
+        LOG(LOG_WARN, "session_dropped", " nick=%s reason=table_full", c->nick);
+        journal_session(J_SESSION_END, c);
+        return;
+    }
+    metrics_add(MET_SUSPENDED, 1);
+    j_suspend_t j = { .room_id = s.room_id, .seat = s.seat, .expires_ms = realtime_ms() + RECONNECT_WINDOW_MS };
+    memcpy(j.token, s.token, sizeof(j.token));
+    memcpy(j.nick, s.nick, sizeof(j.nick));
+    journal_append(J_SESSION_SUSPEND, &j, sizeof(j));
+}
+
+/* RECONNECT: adopt a suspended session; its seat too if the game still waits for it */
+static void reattach_session(client_t *c, const session_t *s) {
+    memcpy(c->token, s->token, sizeof(c->token));
+    memcpy(c->nick, s->nick, sizeof(c->nick));
+    c->state = ST_AUTH;
+    metrics_add(MET_RESUMED, 1);
+    journal_session(J_SESSION_RESUME, c);
+    room_t *r = s->room_id > 0 ? lock_room_by_id(s->room_id) : NULL;
+    if (r && (strcmp(r->nicks[s->seat], s->nick) != 0 || game_resume(&r->game, s->seat) < 0)) {
+        pthread_mutex_unlock(&r->lock); // game ended meanwhile
+        r = NULL;
+    }
+    if (!r) {
+        send_lit(c, "RECONNECT_OK 0 LOBBY");
+        return;
+    }
+    r->players[s->seat] = c->ref;
+    c->room_id = s->room_id;
+    c->state = ST_IN_ROOM;
+    send_line(c, "RECONNECT_OK %d %s", s->room_id, room_state_name(r->game.state));
+    client_ref_t other = r->players[1-s->seat];
+    room_announce(r, other, "PLAYER_JOINED %s", c->nick);
+    if (other != CLIENT_REF_NONE) send_line(c, "PLAYER_JOINED %s", r->nicks[1-s->seat]);
+    room_broadcast_round(r, 0); // the interrupted round is replayed
+    room_set_deadline(r, MOVE_TIMEOUT_MS);
+    rooms_changed(r);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* wheel callback: KEEPALIVE since the timer was armed; re-armed unless the
+ * client really was silent all along, so receiving data costs no wheel work */
+static void client_idle_expired(tw_timer_t *t) {
+    client_t *c = tw_entry(t, client_t, idle_timer);
+    uint64_t idle = reactor_now_ms() - c->last_seen_ms;
+    if (idle < KEEPALIVE_MS) {
+        reactor_timer_arm(t, KEEPALIVE_MS - idle);
+        return;
+    }
+    conn_drop(c); // client_close suspends the session
+}
+
+/* serialize the room table into a fresh snapshot; room_list_lock held */
+static snapshot_t *build_room_list(void) {
+    static char *body;     // grows with the room table; guarded by room_list_lock
+    static size_t body_cap;
+    uint64_t version = atomic_load_explicit(&rooms_version, memory_order_acquire);
+    size_t len = 0;
+    int count = 0;
+    room_t *r;
+    for (uint32_t i=0;(r = room_at(i)) != NULL;i++) {
+        if (atomic_load_explicit(&r->id, memory_order_relaxed) == 0) continue;
+        if (body_cap - len < ROOM_LINE_MAX) {
+            size_t cap = body_cap ? body_cap * 2 : 64 * ROOM_LINE_MAX;
+            char *nb = realloc(body, cap);
+            if (!nb) break;
+            body = nb;
+            body_cap = cap;
         }
-        if (r->player_count >= 2) {
-            pthread_mutex_unlock(&global_lock);
-            send_line(c->fd, "ERR 102 ROOM_FULL");
-            return;
+        pthread_mutex_lock(&r->lock);
+        int id = atomic_load_explicit(&r->id, memory_order_relaxed);
+        if (id != 0) {
+            int n = snprintf(body + len, body_cap - len, "ROOM %d %s %d/2 %s\r\n", id, r->name,
+                             r->player_count, room_state_name(r->game.state));
+            if (n > 0 && (size_t)n < body_cap - len) { len += (size_t)n; count++; }
         }
-        // add player
-        for (int i=0;i<2;i++) if (r->players[i] == -1) { r->players[i] = c->fd; r->player_count++; break; }
-        c->room_id = r->id;
+        pthread_mutex_unlock(&r->lock);
+    }
+    count += cluster_format_rooms(&body, &len, &body_cap); // the other nodes' rooms
+    char head[32];
+    int hlen = snprintf(head, sizeof(head), "ROOM_LIST %d\r\n", count);
+    snapshot_t *snap = snapshot_alloc((size_t)hlen + len);
+    if (!snap) return NULL;
+    memcpy(snap->data, head, (size_t)hlen);
+    if (len) memcpy(snap->data + hlen, body, len);
+    snap->len = (size_t)hlen + len;
+    snap->version = version;
+    return snap;
+}
+
+/* current LIST reply with a reference held; rebuilds only if rooms changed */
+static snapshot_t *get_room_list(void) {
+    snapshot_t *snap = snapshot_acquire(&room_list);
+    if (snap && snap->version == atomic_load_explicit(&rooms_version, memory_order_acquire)) return snap;
+    snapshot_put(snap);
+    pthread_mutex_lock(&room_list_lock);
+    snap = snapshot_acquire(&room_list); // someone may have rebuilt while we waited
+    if (!snap || snap->version != atomic_load_explicit(&rooms_version, memory_order_acquire)) {
+        snapshot_put(snap);
+        snap = build_room_list();
+        if (snap) {
+            atomic_fetch_add_explicit(&snap->refs, 1, memory_order_relaxed); // ours, besides the slot's
+            snapshot_publish(&room_list, snap);
+        }
+    }
+    pthread_mutex_unlock(&room_list_lock);
+    return snap;
+}
+
+/* list rooms: caller must hold no locks. No locking or formatting on the
+ * hot path, the cached reply is queued by reference. */
+static int send_room_list(client_t *c) {
+    snapshot_t *snap = get_room_list();
+    if (!snap) return send_lit(c, "ROOM_LIST 0");
+    int rc = conn_write_shared(c, snap);
+    snapshot_put(snap);
+    return rc;
+}
+
+/* <0 while a name sorts before the prefix range, 0 inside it */
+static int name_prefix_cmp(const ost_node_t *n, const void *key) {
+    const tok_t *prefix = key;
+    return strncmp(ost_entry(n, room_t, by_name)->name, prefix->p, prefix->n);
+}
+
+static int open_name_prefix_cmp(const ost_node_t *n, const void *key) {
+    const tok_t *prefix = key;
+    return strncmp(ost_entry(n, room_t, open_by_name)->name, prefix->p, prefix->n);
+}
+
+/* LIST [OPEN] [PREFIX <prefix>] [<offset> <limit>]: one page of a name
+ * index, at most LIST_PAGE_MAX rooms. -1 on bad arguments. */
+static int send_room_page(client_t *c, const tok_t *arg, int argc) {
+    int i = 1, open = 0;
+    int offset = 0, limit = LIST_PAGE_MAX;
+    char prefix[ROOM_NAME_MAX+1];
+    tok_t pre = { prefix, 0 };
+    if (i < argc && tok_is(arg[i], "OPEN")) { open = 1; i++; }
+    if (i < argc && tok_is(arg[i], "PREFIX")) {
+        if (i + 1 >= argc || arg[i+1].n > ROOM_NAME_MAX) return -1;
+        tok_copy(prefix, sizeof(prefix), arg[i+1]); // NUL-terminated for strncmp
+        pre.n = arg[i+1].n;
+        i += 2;
+    }
+    if (i < argc) {
+        if (argc - i != 2) return -1;
+        offset = tok_to_int(arg[i]);
+        limit = tok_to_int(arg[i+1]);
+        if (offset < 0 || limit < 0) return -1;
+        if (limit > LIST_PAGE_MAX) limit = LIST_PAGE_MAX;
+    }
+
+    ost_t *t = open ? &open_index : &room_index;
+    size_t node_off = open ? offsetof(room_t, open_by_name) : offsetof(room_t, by_name);
+    char body[LIST_PAGE_MAX * ROOM_LINE_MAX];
+    size_t len = 0;
+    int count = 0;
+    pthread_mutex_lock(&room_index_lock);
+    ost_node_t *n;
+    if (pre.n) {
+        n = ost_lower_bound(t, open ? open_name_prefix_cmp : name_prefix_cmp, &pre);
+        if (n && offset) n = ost_at(t, ost_rank(n) + (uint32_t)offset);
+    } else {
+        n = ost_at(t, (uint32_t)offset);
+    }
+    for (;n && count < limit;n = ost_next(n)) {
+        const room_t *r = (const room_t *)((const char *)n - node_off);
+        if (pre.n && strncmp(r->name, prefix, pre.n) != 0) break; // past the prefix range
+        int w = snprintf(body + len, sizeof(body) - len, "ROOM %d %s %d/2 %s\r\n", r->ix_id, r->name,
+                         r->ix_players, room_state_name(r->ix_state));
+        if (w < 0 || (size_t)w >= sizeof(body) - len) break;
+        len += (size_t)w;
+        count++;
+    }
+    pthread_mutex_unlock(&room_index_lock);
+    send_line(c, "ROOM_LIST %d", count);
+    if (len) conn_write(c, body, len);
+    return 0;
+}
+
+/* ---- lobby subscriptions ---- */
+
+static void lobby_arm(uint64_t arg) {
+    (void)arg;
+    reactor_timer_arm(&lobby_timer, LOBBY_BATCH_MS);
+}
+
+/* subscriber side: queue the batch for every local subscriber, by reference */
+static void lobby_deliver(uint64_t arg) {
+    snapshot_t *batch = (snapshot_t *)(uintptr_t)arg;
+    for (client_t *c = lobby_subs[reactor_index()]; c; c = c->sub_next) conn_write_shared(c, batch);
+    snapshot_put(batch);
+}
+
+/* append one room's delta to buf; updates what subscribers know of it */
+static size_t lobby_diff(room_t *r, char *buf, size_t cap) {
+    atomic_store_explicit(&r->dirty, 0, memory_order_release); // a change from here on queues it again
+    pthread_mutex_lock(&r->lock);
+    int id = atomic_load_explicit(&r->id, memory_order_relaxed);
+    int players = r->player_count;
+    room_state_t state = r->game.state;
+    char name[ROOM_NAME_MAX+1];
+    memcpy(name, r->name, sizeof(name));
+    pthread_mutex_unlock(&r->lock);
+
+    size_t len = 0;
+    int n;
+    if (r->pub_id != 0 && r->pub_id != id) {
+        n = snprintf(buf + len, cap - len, "ROOM_REMOVED %d\r\n", r->pub_id);
+        len += (size_t)n;
+        r->pub_id = 0;
+    }
+    if (id != 0 && r->pub_id == 0)
+        n = snprintf(buf + len, cap - len, "ROOM_ADDED %d %s %d/2 %s\r\n", id, name, players, room_state_name(state));
+    else if (id != 0 && (players != r->pub_players || state != r->pub_state))
+        n = snprintf(buf + len, cap - len, "ROOM_UPDATED %d %d/2 %s\r\n", id, players, room_state_name(state));
+    else
+        return len; // coalesced away: back where the subscribers last saw it
+    len += (size_t)n;
+    r->pub_id = id;
+    r->pub_players = players;
+    r->pub_state = state;
+    return len;
+}
+
+/* hand one batch of delta lines to each reactor with subscribers, by reference */
+static void lobby_publish(const char *body, size_t len) {
+    int subs = 0;
+    for (int d=0;d<reactor_count();d++) subs += atomic_load_explicit(&lobby_nsubs[d], memory_order_relaxed);
+    if (len == 0 || subs == 0) return;
+    snapshot_t *batch = snapshot_alloc(len);
+    if (!batch) return;
+    memcpy(batch->data, body, len);
+    batch->len = len;
+    for (int d=0;d<reactor_count();d++) {
+        if (atomic_load_explicit(&lobby_nsubs[d], memory_order_relaxed) == 0) continue;
+        atomic_fetch_add_explicit(&batch->refs, 1, memory_order_relaxed); // one per receiving reactor
+        reactor_call(d, lobby_deliver, (uint64_t)(uintptr_t)batch);
+    }
+    snapshot_put(batch);
+}
+
+/* LOBBY_REACTOR: diff every room queued since the last batch, format the
+ * deltas once and hand the same buffer to each reactor with subscribers */
+static void lobby_flush(tw_timer_t *t) {
+    (void)t;
+    static slot_vec_t work; // swapped with lobby_dirty, so both keep their capacity
+    static char *body;
+    static size_t body_cap;
+    atomic_store_explicit(&lobby_armed, 0, memory_order_release);
+    pthread_mutex_lock(&lobby_lock);
+    slot_vec_t tmp = lobby_dirty;
+    lobby_dirty = work;
+    lobby_dirty.len = 0;
+    work = tmp;
+    pthread_mutex_unlock(&lobby_lock);
+
+    size_t len = 0;
+    for (size_t i=0;i<work.len;i++) {
+        if (body_cap - len < 2 * ROOM_LINE_MAX) { // room for a REMOVED plus an ADDED
+            size_t cap = body_cap ? body_cap * 2 : 64 * ROOM_LINE_MAX;
+            char *nb = realloc(body, cap);
+            if (!nb) {
+                /* out of memory: the rest goes out with its next change */
+                for (;i<work.len;i++) {
+                    room_t *r = room_at(work.slots[i]);
+                    if (r) atomic_store_explicit(&r->dirty, 0, memory_order_relaxed);
+                }
+                break;
+            }
+            body = nb;
+            body_cap = cap;
+        }
+        room_t *r = room_at(work.slots[i]);
+        if (r) len += lobby_diff(r, body + len, body_cap - len);
+    }
+    work.len = 0;
+    lobby_publish(body, len);
+}
+
+/* LOBBY_REACTOR: what the peers' links brought in, to local subscribers */
+static void cluster_flush(tw_timer_t *t) {
+    static char *body;
+    static size_t body_cap;
+    size_t len = cluster_take_deltas(&body, &body_cap);
+    lobby_publish(body, len);
+    reactor_timer_arm(t, LOBBY_BATCH_MS);
+}
+
+/* mirrored rooms changed: on the link thread */
+static void cluster_changed(void) {
+    atomic_fetch_add_explicit(&rooms_version, 1, memory_order_release);
+}
+
+static int lobby_subscribe(client_t *c) {
+    if (c->subscribed) return -1;
+    int me = reactor_index();
+    c->subscribed = 1;
+    c->sub_prev = NULL;
+    c->sub_next = lobby_subs[me];
+    if (c->sub_next) c->sub_next->sub_prev = c;
+    lobby_subs[me] = c;
+    atomic_store_explicit(&lobby_nsubs[me], atomic_load_explicit(&lobby_nsubs[me], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    return 0;
+}
+
+static int lobby_unsubscribe(client_t *c) {
+    if (!c->subscribed) return -1;
+    int me = reactor_index();
+    c->subscribed = 0;
+    if (c->sub_prev) c->sub_prev->sub_next = c->sub_next;
+    else lobby_subs[me] = c->sub_next;
+    if (c->sub_next) c->sub_next->sub_prev = c->sub_prev;
+    atomic_store_explicit(&lobby_nsubs[me], atomic_load_explicit(&lobby_nsubs[me], memory_order_relaxed) - 1,
+                          memory_order_relaxed);
+    return 0;
+}
+
+/* SUBSCRIBE/UNSUBSCRIBE: LOBBY is the only topic */
+static int is_lobby_topic(const tok_t *arg, int argc) {
+    return argc >= 2 && tok_is(arg[1], "LOBBY");
+}
+
+/* ---- quick match ----
+ * A queued client's table slot holds its ticket; the entry on the ring is
+ * only good while that ticket is still there. A matcher claims a client by
+ * swapping the ticket to 0, and so does the owner to cancel, so exactly one
+ * of them wins. Claimed clients are seated by their own reactor. A slot has
+ * at most one entry on the ring: QUEUE waits until a cancelled one is gone. */
+
+static _Atomic uint32_t *queue_state(client_ref_t ref) {
+    return &client_tables[REF_REACTOR(ref)].queued[REF_SLOT(ref)];
+}
+
+static _Atomic uint32_t *ring_state(client_ref_t ref) {
+    return &client_tables[REF_REACTOR(ref)].on_ring[REF_SLOT(ref)];
+}
+
+/* e left the ring: popped for a pair, or for good */
+static void match_off_ring(const match_entry_t *e) {
+    uint32_t want = e->ticket;
+    atomic_compare_exchange_strong_explicit(ring_state(e->ref), &want, 0, memory_order_release,
+                                            memory_order_relaxed);
+}
+
+static void match_drop(const match_entry_t *e) {
+    match_off_ring(e);
+    atomic_fetch_sub_explicit(&matchq_len, 1, memory_order_relaxed);
+}
+
+static int match_live(const match_entry_t *e) {
+    return atomic_load_explicit(queue_state(e->ref), memory_order_acquire) == e->ticket;
+}
+
+static int match_claim(const match_entry_t *e) {
+    uint32_t want = e->ticket;
+    if (!atomic_compare_exchange_strong_explicit(queue_state(e->ref), &want, 0, memory_order_acq_rel,
+                                                 memory_order_acquire))
+        return 0;
+    match_off_ring(e);
+    return 1;
+}
+
+/* put a claimed entry back; it stays in its ring cell reservation */
+static void match_return(const match_entry_t *e) {
+    uint32_t none = 0;
+    if (atomic_compare_exchange_strong_explicit(queue_state(e->ref), &none, e->ticket, memory_order_acq_rel,
+                                                memory_order_acquire)) {
+        atomic_store_explicit(ring_state(e->ref), e->ticket, memory_order_relaxed);
+        matchq_push(&matchq, e); // cannot fail: matchq_len still counts it
+    } else
+        atomic_fetch_sub_explicit(&matchq_len, 1, memory_order_relaxed); // slot reused meanwhile: owner is gone
+}
+
+static void match_arm(void) {
+    tw_timer_t *t = &match_timers[reactor_index()];
+    if (!tw_armed(t)) reactor_timer_arm(t, MATCH_BATCH_MS);
+}
+
+/* push c with a fresh ticket; -1 if the ring is full, -2 while the entry of
+ * an earlier QUEUE is still on it (a matcher pass is armed to drop it) */
+static int queue_join(client_t *c) {
+    if (atomic_load_explicit(ring_state(c->ref), memory_order_acquire)) {
+        match_arm();
+        return -2;
+    }
+    if (atomic_fetch_add_explicit(&matchq_len, 1, memory_order_relaxed) >= matchq_cap) {
+        atomic_fetch_sub_explicit(&matchq_len, 1, memory_order_relaxed);
+        return -1;
+    }
+    client_table_t *t = &client_tables[reactor_index()];
+    if (++t->next_ticket == 0) t->next_ticket = 1;
+    match_entry_t e = { .ref = c->ref, .ticket = t->next_ticket };
+    memcpy(e.nick, c->nick, sizeof(e.nick));
+    c->queue_ticket = e.ticket;
+    atomic_store_explicit(ring_state(c->ref), e.ticket, memory_order_relaxed);
+    atomic_store_explicit(queue_state(c->ref), e.ticket, memory_order_release);
+    matchq_push(&matchq, &e);
+    match_arm();
+    return 0;
+}
+
+/* 0 if c left the queue, 1 if a matcher holds it already, -1 if not queued.
+ * A cancelled entry stays on the ring until a matcher drops it. */
+static int queue_leave(client_t *c) {
+    if (!c->queue_ticket) return -1;
+    uint32_t want = c->queue_ticket;
+    if (!atomic_compare_exchange_strong_explicit(queue_state(c->ref), &want, 0, memory_order_acq_rel,
+                                                 memory_order_acquire))
+        return 1;
+    c->queue_ticket = 0;
+    return 0;
+}
+
+/* owner side: the match was called off before c heard of it */
+static void queue_requeue(uint64_t ref) {
+    client_t *c = client_lookup(ref);
+    if (!c || !c->queue_ticket) return;
+    c->queue_ticket = 0;
+    if (queue_join(c) < 0) send_lit(c, "ERR 200 SERVER_FULL");
+}
+
+/* owner side: tell a claimed client about its match (arg = room id << 1 | seat) */
+static void queue_matched(uint64_t arg) {
+    int id = (int)(arg >> 1), seat = (int)(arg & 1);
+    room_t *r = lock_room_by_id(id);
+    if (!r) return; // called off: a queue_requeue is on its way if c is still here
+    r->pending &= (uint8_t)~(1u << seat);
+    client_t *c = client_lookup(r->players[seat]);
+    if (c) {
+        c->queue_ticket = 0;
+        c->room_id = id;
         c->state = ST_IN_ROOM;
-        pthread_mutex_unlock(&global_lock);
-        send_line(c->fd, "ROOM_JOINED %d", r->id);
+        send_word_uint(c, "ROOM_JOINED", (uint64_t)id);
+        send_line(c, "PLAYER_JOINED %s", r->nicks[1-seat]);
+        send_lit(c, "GAME_START");
+        send_word_uint(c, "ROUND_START", (uint64_t)r->game.round);
+    } else if (r->players[seat] != CLIENT_REF_NONE) { // closed after being claimed
+        client_ref_t other = r->players[1-seat];
+        if (r->pending && other != CLIENT_REF_NONE) {
+            release_room(r); // the other seat has not heard of it yet: back into the queue
+            reactor_call(REF_REACTOR(other), queue_requeue, other);
+        } else {
+            vacate_seat(r, seat); // like a disconnect right after GAME_START
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* seat two claimed players in a fresh room and start the game; -1 if out of rooms */
+static int match_pair(const match_entry_t *a, const match_entry_t *b) {
+    char name[ROOM_NAME_MAX+1];
+    snprintf(name, sizeof(name), "%.29s_vs_%.29s", a->nick, b->nick); // fits ROOM_NAME_MAX
+    room_t *r = open_room(name);
+    if (!r) return -1;
+    const match_entry_t *e[2] = { a, b };
+    for (int i=0;i<2;i++) {
+        r->players[i] = e[i]->ref;
+        memcpy(r->nicks[i], e[i]->nick, sizeof(r->nicks[i]));
+    }
+    r->player_count = 2;
+    r->pending = 3;
+    game_seated(&r->game, 2);
+    game_ready(&r->game, 0);
+    game_ready(&r->game, 1);
+    room_set_deadline(r, MOVE_TIMEOUT_MS);
+    rooms_changed(r);
+    uint64_t id = (uint64_t)atomic_load_explicit(&r->id, memory_order_relaxed);
+    pthread_mutex_unlock(&r->lock);
+    for (int i=0;i<2;i++) reactor_call(REF_REACTOR(e[i]->ref), queue_matched, id << 1 | (uint64_t)i);
+    return 0;
+}
+
+/* batch timer of any reactor: pair what is on the ring, in arrival order */
+static void match_run(tw_timer_t *t) {
+    match_entry_t held, e;
+    int have = 0, held_claimed = 0, n;
+    for (n=0;n<MATCH_BATCH;n++) {
+        if (matchq_pop(&matchq, &e) < 0) break;
+        if (!match_live(&e)) { match_drop(&e); continue; } // cancelled or closed
+        if (!have) { held = e; have = 1; continue; }
+        if (!held_claimed && !match_claim(&held)) { // gone since it was popped
+            match_drop(&held);
+            held = e;
+            continue;
+        }
+        held_claimed = 1;
+        if (!match_claim(&e)) { match_drop(&e); continue; }
+        if (match_pair(&held, &e) < 0) {
+            match_return(&held);
+            match_return(&e);
+            reactor_timer_arm(t, MATCH_RETRY_MS);
+            return;
+        }
+        atomic_fetch_sub_explicit(&matchq_len, 2, memory_order_relaxed);
+        have = held_claimed = 0;
+    }
+    if (have) {
+        if (held_claimed) match_return(&held);
+        else matchq_push(&matchq, &held); // cannot fail, see match_return
+    }
+    /* more than a batch, or a partner another matcher set aside meanwhile */
+    if (n == MATCH_BATCH || atomic_load_explicit(&matchq_len, memory_order_relaxed) >= 2) reactor_timer_arm(t, MATCH_BATCH_MS);
+}
+
+/* HELLO <nick> BIN, RECONNECT <token> BIN: frames from the reply on */
+static int wants_binary(const tok_t *arg, int argc) {
+    return argc >= 3 && tok_is(arg[2], "BIN");
+}
+
+static void cmd_hello(client_t *c, const tok_t *arg, int argc) {
+    if (argc < 2) { bad_format(c, "missing_nick"); return; }
+    if (wants_binary(arg, argc)) c->binary = 1; // WELCOME is the first frame
+    tok_copy(c->nick, sizeof(c->nick), arg[1]);
+    token_generate(c->token);
+    cluster_mark_token(c->token);
+    c->state = ST_AUTH;
+    journal_session(J_SESSION_NEW, c);
+    send_line(c, "WELCOME %s", c->token);
+}
+
+static void cmd_list(client_t *c, const tok_t *arg, int argc) {
+    if (c->state < ST_AUTH) { send_lit(c, "ERR 101 INVALID_STATE not_auth"); return; }
+    if (argc == 1) { send_room_list(c); return; }
+    if (send_room_page(c, arg, argc) < 0) bad_format(c, "bad_list_args");
+}
+
+static void cmd_create(client_t *c, const tok_t *arg, int argc) {
+    if (c->state < ST_AUTH) { send_lit(c, "ERR 101 INVALID_STATE"); return; }
+    if (argc < 2) { bad_format(c, "missing_room_name"); return; }
+    char rname[ROOM_NAME_MAX+1];
+    tok_copy(rname, sizeof(rname), arg[1]);
+    int rid = create_room(rname);
+    if (rid < 0) { send_lit(c, "ERR 200 SERVER_FULL"); return; }
+    send_word_uint(c, "ROOM_CREATED", (uint64_t)rid);
+}
+
+static void cmd_join(client_t *c, const tok_t *arg, int argc) {
+    if (c->state < ST_AUTH) { send_lit(c, "ERR 101 INVALID_STATE not_auth"); return; }
+    if (argc < 2) { bad_format(c, "missing_room_id"); return; }
+    int rid = tok_to_int(arg[1]);
+    if (rid < 0) { bad_format(c, "bad_room_id"); return; }
+    int seat;
+    room_t *r = lock_client_room(c, &seat);
+    if (r) {
+        pthread_mutex_unlock(&r->lock);
+        send_lit(c, "ERR 101 INVALID_STATE already_in_room");
         return;
-    } else if (strcmp(cmd, "QUIT") == 0) {
-        send_line(c->fd, "OK bye");
-        // close handled by caller
+    }
+    if (c->queue_ticket) { send_lit(c, "ERR 101 INVALID_STATE queued"); return; }
+    if (watching(c)) { send_lit(c, "ERR 101 INVALID_STATE watching"); return; }
+    if (cluster_remote_room(rid)) { send_redirect(c, cluster_room_node(rid)); return; }
+    r = lock_room_by_id(rid);
+    if (!r) {
+        send_lit(c, "ERR 104 UNKNOWN_ROOM");
         return;
-    } else if (strcmp(cmd, "PING") == 0) {
-        send_line(c->fd, "PONG");
+    }
+    if (r->player_count >= 2) {
+        pthread_mutex_unlock(&r->lock);
+        send_lit(c, "ERR 102 ROOM_FULL");
         return;
-    } else {
-        send_line(c->fd, "ERR 100 BAD_FORMAT unknown_command");
+    }
+    // add player
+    seat = r->players[0] == CLIENT_REF_NONE ? 0 : 1;
+    r->players[seat] = c->ref;
+    memcpy(r->nicks[seat], c->nick, sizeof(r->nicks[seat]));
+    r->player_count++;
+    game_seated(&r->game, r->player_count);
+    c->room_id = rid;
+    c->state = ST_IN_ROOM;
+    send_word_uint(c, "ROOM_JOINED", (uint64_t)rid);
+    // tell both seats about each other; the other one may be on another reactor
+    client_ref_t other = r->players[1-seat];
+    room_announce(r, other, "PLAYER_JOINED %s", c->nick);
+    if (other != CLIENT_REF_NONE) send_line(c, "PLAYER_JOINED %s", r->nicks[1-seat]);
+    rooms_changed(r);
+    pthread_mutex_unlock(&r->lock);
+}
+
+static void cmd_leave(client_t *c, const tok_t *arg, int argc) {
+    (void)arg; (void)argc;
+    if (leave_room(c) < 0) { send_lit(c, "ERR 105 NOT_IN_ROOM"); return; }
+    send_lit(c, "LEFT");
+}
+
+static void cmd_ready(client_t *c, const tok_t *arg, int argc) {
+    (void)arg; (void)argc;
+    int seat;
+    room_t *r = lock_client_room(c, &seat);
+    if (!r) { send_lit(c, "ERR 105 NOT_IN_ROOM"); return; }
+    int rc = game_ready(&r->game, seat);
+    if (rc < 0) {
+        pthread_mutex_unlock(&r->lock);
+        send_lit(c, "ERR 101 INVALID_STATE");
         return;
     }
+    send_lit(c, "OK ready");
+    if (rc == 1) {
+        room_broadcast_lit(r, 0, "GAME_START");
+        room_broadcast_round(r, 1);
+        room_set_deadline(r, MOVE_TIMEOUT_MS);
+        rooms_changed(r);
+    }
+    pthread_mutex_unlock(&r->lock);
 }
 
-/* client thread */
-static void *client_worker(void *arg) {
-    client_t *c = (client_t*)arg;
-    char buf[LINE_BUF];
-    ssize_t n;
-    FILE *f = fdopen(c->fd, "r+");
-    if (!f) {
-        perror("fdopen");
-        close(c->fd);
-        unregister_client(c);
-        free(c);
-        return NULL;
+static void cmd_move(client_t *c, const tok_t *arg, int argc) {
+    if (argc < 2) { bad_format(c, "missing_move"); return; }
+    move_t m = arg[1].n == 1 ? move_parse(arg[1].p[0]) : MOVE_NONE;
+    if (m == MOVE_NONE) { bad_format(c, "bad_move"); return; }
+    int seat;
+    room_t *r = lock_client_room(c, &seat);
+    if (!r) { send_lit(c, "ERR 105 NOT_IN_ROOM"); return; }
+    int rc = game_move(&r->game, seat, m);
+    if (rc < 0) {
+        pthread_mutex_unlock(&r->lock);
+        send_lit(c, "ERR 101 INVALID_STATE");
+        return;
     }
-    setvbuf(f, NULL, _IOLBF, 0);
-    while (fgets(buf, sizeof(buf), f) != NULL) {
-        c->last_seen = time(NULL);
-        handle_line(c, buf);
+    send_lit(c, "MOVE_ACCEPTED");
+    if (rc == 1) finish_round(r);
+    pthread_mutex_unlock(&r->lock);
+}
+
+static void cmd_quit(client_t *c, const tok_t *arg, int argc) {
+    (void)arg; (void)argc;
+    send_lit(c, "OK bye");
+    c->closing = 1; // reactor closes once "OK bye" is flushed
+}
+
+static void cmd_ping(client_t *c, const tok_t *arg, int argc) {
+    (void)arg; (void)argc;
+    send_lit(c, "PONG");
+}
+
+static void cmd_reconnect(client_t *c, const tok_t *arg, int argc) {
+    if (c->state != ST_CONNECTED) { send_lit(c, "ERR 101 INVALID_STATE already_auth"); return; }
+    if (argc < 2) { bad_format(c, "missing_token"); return; }
+    if (wants_binary(arg, argc)) c->binary = 1;
+    int node = arg[1].n == TOKEN_LEN ? cluster_token_node(arg[1].p) : -1;
+    if (node >= 0 && node != cluster_self) { send_redirect(c, node); return; }
+    session_t s;
+    if (session_take(arg[1].p, arg[1].n, reactor_now_ms(), &s) < 0) { send_lit(c, "ERR 103 AUTH_FAIL"); return; }
+    reattach_session(c, &s);
+}
+
+static void cmd_subscribe(client_t *c, const tok_t *arg, int argc) {
+    if (c->state < ST_AUTH) { send_lit(c, "ERR 101 INVALID_STATE not_auth"); return; }
+    if (!is_lobby_topic(arg, argc)) { bad_format(c, "unknown_topic"); return; }
+    if (lobby_subscribe(c) < 0) { send_lit(c, "ERR 101 INVALID_STATE already_subscribed"); return; }
+    send_lit(c, "OK subscribed");
+    send_room_list(c); // the baseline the deltas apply to
+}
+
+static void cmd_unsubscribe(client_t *c, const tok_t *arg, int argc) {
+    if (!is_lobby_topic(arg, argc)) { bad_format(c, "unknown_topic"); return; }
+    if (lobby_unsubscribe(c) < 0) { send_lit(c, "ERR 101 INVALID_STATE not_subscribed"); return; }
+    send_lit(c, "OK unsubscribed");
+}
+
+static void cmd_queue(client_t *c, const tok_t *arg, int argc) {
+    (void)arg; (void)argc;
+    if (c->state < ST_AUTH) { send_lit(c, "ERR 101 INVALID_STATE not_auth"); return; }
+    if (c->queue_ticket) { send_lit(c, "ERR 101 INVALID_STATE already_queued"); return; }
+    int seat;
+    room_t *r = lock_client_room(c, &seat);
+    if (r) {
+        pthread_mutex_unlock(&r->lock);
+        send_lit(c, "ERR 101 INVALID_STATE already_in_room");
+        return;
     }
-    // cleanup on disconnect
-    fprintf(stderr, "Client %s disconnected\n", c->nick);
-    close(c->fd);
+    if (watching(c)) { send_lit(c, "ERR 101 INVALID_STATE watching"); return; }
+    int rc = queue_join(c);
+    if (rc == -2) { send_lit(c, "ERR 101 INVALID_STATE unqueue_pending"); return; }
+    if (rc < 0) { send_lit(c, "ERR 200 SERVER_FULL"); return; }
+    send_lit(c, "OK queued");
+}
+
+static void cmd_unqueue(client_t *c, const tok_t *arg, int argc) {
+    (void)arg; (void)argc;
+    int rc = queue_leave(c);
+    if (rc < 0) send_lit(c, "ERR 101 INVALID_STATE not_queued");
+    else if (rc > 0) send_lit(c, "ERR 101 INVALID_STATE matching");
+    else send_lit(c, "OK unqueued");
+}
+
+static void cmd_watch(client_t *c, const tok_t *arg, int argc) {
+    if (c->state < ST_AUTH) { send_lit(c, "ERR 101 INVALID_STATE not_auth"); return; }
+    if (argc < 2) { bad_format(c, "missing_room_id"); return; }
+    int rid = tok_to_int(arg[1]);
+    if (rid < 0) { bad_format(c, "bad_room_id"); return; }
+    int seat;
+    room_t *r = lock_client_room(c, &seat);
+    if (r) {
+        pthread_mutex_unlock(&r->lock);
+        send_lit(c, "ERR 101 INVALID_STATE already_in_room");
+        return;
+    }
+    if (c->queue_ticket) { send_lit(c, "ERR 101 INVALID_STATE queued"); return; }
+    if (watching(c)) { send_lit(c, "ERR 101 INVALID_STATE already_watching"); return; }
+    if (cluster_remote_room(rid)) { send_redirect(c, cluster_room_node(rid)); return; }
+    r = lock_room_by_id(rid);
+    if (!r) { send_lit(c, "ERR 104 UNKNOWN_ROOM"); return; }
+    if (watch_add(r, c->ref) < 0) {
+        pthread_mutex_unlock(&r->lock);
+        send_lit(c, "ERR 200 SERVER_FULL");
+        return;
+    }
+    c->watch_room = rid;
+    /* queued before unlocking: every later room line lands after it */
+    send_line(c, "WATCHING %d %s %s %d %d %d %s", rid, r->players[0] != CLIENT_REF_NONE ? r->nicks[0] : "-",
+              r->players[1] != CLIENT_REF_NONE ? r->nicks[1] : "-", r->game.score[0], r->game.score[1],
+              r->game.round, room_state_name(r->game.state));
+    pthread_mutex_unlock(&r->lock);
+}
+
+static void cmd_unwatch(client_t *c, const tok_t *arg, int argc) {
+    (void)arg; (void)argc;
+    if (unwatch(c) < 0) { send_lit(c, "ERR 101 INVALID_STATE not_watching"); return; }
+    send_lit(c, "OK unwatched");
+}
+
+static void cmd_unknown(client_t *c, const tok_t *arg, int argc) {
+    (void)arg; (void)argc;
+    bad_format(c, "unknown_command");
+}
+
+/* indexed by cmd_t, filled in from COMMANDS */
+static void (*const cmd_handlers[CMD_COUNT])(client_t *c, const tok_t *arg, int argc) = {
+    [CMD_UNKNOWN] = cmd_unknown,
+#define X(word, fn) [CMD_##word] = cmd_##fn,
+    COMMANDS(X)
+#undef X
+};
+
+/* both codecs end here: arg[0] is the command word */
+static void dispatch(client_t *c, const tok_t *arg, int argc) {
+    cmd_t cmd = lookup_cmd(arg[0]);
+    uint64_t t0 = metrics_now_ns();
+    cmd_handlers[cmd](c, arg, argc);
+    metrics_record(MET_OP_CMD + cmd, metrics_now_ns() - t0);
+}
+
+/* handle one framed line (CRLF already stripped, not NUL-terminated) */
+void handle_line(client_t *c, const char *line, size_t len) {
+    if (!rate_admit(c)) { abuse_close(c, "rate"); return; }
+    tok_t arg[MAX_ARGS];
+    int argc = tokenize(line, len, arg, MAX_ARGS);
+    if (argc == 0) return;
+    dispatch(c, arg, argc);
+}
+
+/* a string field that could have been a token of a text line */
+static int is_token(const char *p, size_t n) {
+    if (n == 0) return 0;
+    for (size_t i=0;i<n;i++) if (p[i] == ' ' || p[i] == '\r' || p[i] == '\n') return 0;
+    return 1;
+}
+
+/* handle one binary frame: the opcode becomes the command word and every
+ * field a token, so the handlers see exactly what the text line gives it */
+void handle_frame(client_t *c, const char *frame, size_t len) {
+    if (!rate_admit(c)) { abuse_close(c, "rate"); return; }
+    if (!frame) { bad_format(c, "bad_frame"); return; }
+    tok_t arg[MAX_ARGS];
+    char num[MAX_ARGS][20];
+    int argc = 0, r = 0;
+    if (frame[0] != CODEC_OP_WORD) { // an unassigned opcode is an unknown command
+        const char *w = codec_word((uint8_t)frame[0]);
+        arg[argc++] = (tok_t){ w ? w : "", w ? strlen(w) : 0 };
+    }
+    const uint8_t *p = (const uint8_t *)frame + 1, *end = (const uint8_t *)frame + len;
+    codec_field_t f;
+    while (argc < MAX_ARGS && (r = codec_field(&p, end, &f)) > 0) { // like tokenize, the rest is ignored
+        if (f.is_num) {
+            arg[argc].p = num[argc];
+            arg[argc].n = u64_to_dec(num[argc], f.num);
+        } else if (is_token(f.p, f.n)) {
+            arg[argc] = (tok_t){ f.p, f.n };
+        } else {
+            r = -1;
+            break;
+        }
+        argc++;
+    }
+    if (r < 0 || argc == 0) { bad_format(c, "bad_frame"); return; }
+    dispatch(c, arg, argc);
+}
+
+/* reactor callback: line exceeded LINE_BUF, the rest of it is discarded */
+void handle_overlong_line(client_t *c) {
+    metrics_add(MET_OVERLONG, 1);
+    bad_format(c, "line_too_long");
+}
+
+/* reactor callback: new non-blocking connection */
+int client_open(client_t *c) {
+    c->state = ST_CONNECTED;
+    c->room_id = -1;
+    c->last_seen_ms = reactor_now_ms();
+    if (register_client(c) != 0) {
+        static const char full[] = "ERR 200 SERVER_FULL\r\n";
+        send(c->fd, full, sizeof(full)-1, MSG_NOSIGNAL);
+        return -1;
+    }
+    c->idle_timer.cb = client_idle_expired;
+    reactor_timer_arm(&c->idle_timer, KEEPALIVE_MS);
+    return 0;
+}
+
+/* reactor callback: fd already closed, reactor frees c afterwards */
+void client_close(client_t *c) {
+    LOG(LOG_INFO, "disconnect", " nick=%s state=%d quit=%d", c->nick[0] ? c->nick : "-", c->state, c->closing);
+    reactor_timer_cancel(&c->idle_timer);
+    lobby_unsubscribe(c);
+    queue_leave(c); // if a matcher got it first, queue_matched gives the seat up
+    unwatch(c);
+    if (!c->closing && c->state >= ST_AUTH) suspend_session(c); // not for QUIT
+    else if (c->state >= ST_AUTH) journal_session(J_SESSION_END, c);
+    leave_room(c);
     unregister_client(c);
-    free(c);
-    return NULL;
 }
 
-int main(int argc, char **argv) {
-    const char *host = "0.0.0.0";
-    const char *port = "10000";
-    if (argc >= 2) port = argv[1];
-    int listen_fd;
-    struct sockaddr_in servaddr;
-
-    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) { perror("socket"); exit(1); }
-    int opt = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = INADDR_ANY;
-    servaddr.sin_port = htons(atoi(port));
-
-    if (bind(listen_fd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0) { perror("bind"); exit(1); }
-    if (listen(listen_fd, LISTEN_BACKLOG) < 0) { perror("listen"); exit(1); }
-    fprintf(stderr, "Server listening on 0.0.0.0:%s\n", port);
-
-    /* init arrays */
-    for (int i=0;i<MAX_CLIENTS;i++) clients[i] = NULL;
-    for (int i=0;i<MAX_ROOMS;i++) rooms[i].id = 0;
-
-    while (1) {
-        struct sockaddr_in cliaddr;
-        socklen_t clilen = sizeof(cliaddr);
-        int connfd = accept(listen_fd, (struct sockaddr*)&cliaddr, &clilen);
-        if (connfd < 0) {
-            perror("accept");
-            continue;
+/* size the client tables, room directory and session table from config */
+static void tables_init(void) {
+    for (int i=0;i<config.workers;i++) {
+        client_table_t *t = &client_tables[i];
+        t->slots = calloc((size_t)config.max_clients, sizeof(*t->slots));
+        t->queued = calloc((size_t)config.max_clients, sizeof(*t->queued));
+        t->on_ring = calloc((size_t)config.max_clients, sizeof(*t->on_ring));
+        if (!t->slots || !t->queued || !t->on_ring || slot_stack_init(&t->ids, (uint32_t)config.max_clients) < 0) {
+            perror("calloc");
+            exit(1);
+        }
+        match_timers[i].cb = match_run;
+    }
+    matchq_cap = 2 * (size_t)config.max_clients * (size_t)config.workers; // leaves room for cancelled entries
+    if (matchq_init(&matchq, matchq_cap) < 0) { perror("matchq_init"); exit(1); }
+    room_slot_bits = 1;
+    while ((1 << room_slot_bits) < config.max_rooms) room_slot_bits++;
+    room_gen_max = (1u << (31 - room_slot_bits - cluster_node_bits)) - 1;
+    nroom_chunks = ((size_t)config.max_rooms + ROOM_CHUNK - 1) / ROOM_CHUNK;
+    room_chunks = calloc(nroom_chunks, sizeof(*room_chunks));
+    if (!room_chunks || slot_stack_init(&room_slots, (uint32_t)config.max_rooms) < 0) { perror("calloc"); exit(1); }
+    if (session_init((size_t)config.max_clients * (size_t)config.workers) < 0) { perror("session_init"); exit(1); }
+    ost_init(&room_index, by_name_cmp);
+    ost_init(&open_index, open_by_name_cmp);
+    lobby_timer.cb = lobby_flush;
+    cluster_timer.cb = cluster_flush;
+}
+
+/* ---- hot restart ----
+ * The old process quiesces its reactors and streams its state as the records
+ * below, every client with its fd and followed by its unsent output. The new
+ * one rebuilds the tables before any reactor runs and acks; the old one then
+ * exits, and each new reactor re-arms what it owns (handoff_start). Times are
+ * CLOCK_MONOTONIC, the same in both processes; ids and refs keep their
+ * values, so does everything holding one. */
+
+#define HO_MAGIC 0x52505348u // "RPSH"
+#define HO_VERSION 4
+#define HO_GENS 4096        // room generations per record
+#define HO_OUT_CHUNK 32768  // unsent output bytes per record
+#define HO_SESSIONS 256     // suspended sessions per record
+
+enum { HO_CONFIG = 1, HO_TABLE, HO_CLIENT, HO_OUT, HO_GENS_REC, HO_ROOM, HO_SESSIONS_REC, HO_END, HO_ACK };
+
+/* the new process takes these over instead of its own flags; one listen fd per worker attached */
+typedef struct {
+    uint32_t magic, version;
+    int32_t workers, max_clients, max_rooms, backlog;
+    int32_t cluster_nodes, cluster_self; // ids depend on them: the new flags must agree
+} ho_config_t;
+
+/* a reactor's client table; its clients follow */
+typedef struct {
+    int32_t idx;
+    uint32_t gen, used, next_ticket;
+} ho_table_t;
+
+/* one client, its fd attached; rbuf holds rlen bytes of an unfinished line */
+typedef struct {
+    client_ref_t ref;
+    uint64_t last_seen_ms;
+    int32_t state, room_id, watch_room;
+    uint8_t closing, discard, subscribed, queued, binary;
+    char nick[NICK_MAX+1];
+    char token[TOKEN_LEN+1];
+    uint16_t rlen;
+    char rbuf[RECV_BUF];
+} ho_client_t;
+
+typedef struct {
+    client_ref_t ref;
+    char data[HO_OUT_CHUNK];
+} ho_out_t;
+
+/* received output, kept until the owning reactor queues it in handoff_start:
+ * output queue segments come from the pools of the reactor that flushes them */
+typedef struct ho_staged {
+    struct ho_staged *next;
+    client_t *c;
+    size_t len;
+    char data[];
+} ho_staged_t;
+static struct { ho_staged_t *head, *tail; } ho_staged[MAX_WORKERS]; // in arrival order
+
+/* generations of room slots [base, base + n), so reused slots keep minting new ids */
+typedef struct {
+    uint32_t base, n;
+    uint32_t gen[HO_GENS];
+} ho_gens_t;
+
+/* a live room, or a free one the lobby subscribers still know of */
+typedef struct {
+    uint32_t slot;
+    int32_t id, player_count;
+    game_t game;
+    client_ref_t players[2];
+    uint64_t deadline_ms;
+    int32_t pub_id, pub_players, pub_state;
+    uint8_t pending;
+    char name[ROOM_NAME_MAX+1];
+    char nicks[2][NICK_MAX+1];
+} ho_room_t;
+
+typedef struct {
+    uint32_t n;
+    session_t s[HO_SESSIONS];
+} ho_sessions_t;
+
+/* what was sent, checked by the receiver */
+typedef struct {
+    uint64_t clients, rooms, sessions;
+    uint32_t rooms_used;
+} ho_end_t;
+
+_Static_assert(sizeof(ho_client_t) <= HANDOFF_MAX_REC && sizeof(ho_out_t) <= HANDOFF_MAX_REC &&
+               sizeof(ho_gens_t) <= HANDOFF_MAX_REC && sizeof(ho_sessions_t) <= HANDOFF_MAX_REC,
+               "handoff records must fit HANDOFF_MAX_REC");
+_Static_assert(MAX_WORKERS <= HANDOFF_MAX_FDS, "all listen fds go in one record");
+
+typedef struct {
+    int fd;
+    ho_sessions_t rec;
+    uint64_t count;
+} ho_session_batch_t;
+
+static int ho_flush_sessions(ho_session_batch_t *b) {
+    if (b->rec.n == 0) return 0;
+    int rc = handoff_send(b->fd, HO_SESSIONS_REC, &b->rec, offsetof(ho_sessions_t, s) + b->rec.n * sizeof(session_t), NULL, 0);
+    b->rec.n = 0;
+    return rc;
+}
+
+static int ho_add_session(const session_t *s, void *arg) {
+    ho_session_batch_t *b = arg;
+    b->rec.s[b->rec.n++] = *s;
+    b->count++;
+    return b->rec.n == HO_SESSIONS ? ho_flush_sessions(b) : 0;
+}
+
+static int ho_send_client(int fd, const client_t *c) {
+    static ho_client_t rec; // handoff thread only
+    static ho_out_t out;
+    rec.ref = c->ref;
+    rec.last_seen_ms = c->last_seen_ms;
+    rec.state = c->state;
+    rec.room_id = c->room_id;
+    rec.watch_room = c->watch_room;
+    rec.closing = c->closing;
+    rec.discard = c->discard;
+    rec.binary = c->binary;
+    rec.subscribed = c->subscribed;
+    rec.queued = c->queue_ticket != 0;
+    memcpy(rec.nick, c->nick, sizeof(rec.nick));
+    memcpy(rec.token, c->token, sizeof(rec.token));
+    rec.rlen = c->rbuf ? (uint16_t)(c->rtail - c->rhead) : 0;
+    if (rec.rlen) memcpy(rec.rbuf, c->rbuf + c->rhead, rec.rlen);
+    if (handoff_send(fd, HO_CLIENT, &rec, offsetof(ho_client_t, rbuf) + rec.rlen, &c->fd, 1) < 0) return -1;
+    out.ref = c->ref;
+    size_t n;
+    for (size_t off=0;(n = outq_peek(&c->out, off, out.data, sizeof(out.data))) > 0;off += n)
+        if (handoff_send(fd, HO_OUT, &out, offsetof(ho_out_t, data) + n, NULL, 0) < 0) return -1;
+    return 0;
+}
+
+/* old process, reactors quiesced: send everything, 0 once the new one acked */
+static int handoff_export(int fd, ho_end_t *end) {
+    ho_config_t cfg = { HO_MAGIC, HO_VERSION, config.workers, config.max_clients, config.max_rooms, config.backlog,
+                         cluster_nodes, cluster_self };
+    if (handoff_send(fd, HO_CONFIG, &cfg, sizeof(cfg), listen_fds, config.workers) < 0) return -1;
+    memset(end, 0, sizeof(*end));
+    for (int i=0;i<config.workers;i++) {
+        client_table_t *t = &client_tables[i];
+        ho_table_t tr = { i, t->gen, t->ids.used, t->next_ticket };
+        if (handoff_send(fd, HO_TABLE, &tr, sizeof(tr), NULL, 0) < 0) return -1;
+        for (uint32_t slot=0;slot<t->ids.used;slot++) {
+            const client_t *c = t->slots[slot];
+            if (!c) continue;
+            if (ho_send_client(fd, c) < 0) return -1;
+            end->clients++;
         }
-        fprintf(stderr, "New connection fd=%d\n", connfd);
-        client_t *c = calloc(1, sizeof(client_t));
-        c->fd = connfd;
-        c->state = ST_CONNECTED;
-        c->room_id = -1;
-        c->last_seen = time(NULL);
-        gen_token(c->token, sizeof(c->token));
-        if (register_client(c) != 0) {
-            send_line(connfd, "ERR 200 SERVER_FULL");
-            close(connfd);
-            free(c);
+    }
+
+    static ho_gens_t gens;
+    end->rooms_used = room_slots.used;
+    for (uint32_t base=0;base<end->rooms_used;base+=HO_GENS) {
+        gens.base = base;
+        gens.n = end->rooms_used - base < HO_GENS ? end->rooms_used - base : HO_GENS;
+        for (uint32_t i=0;i<gens.n;i++) {
+            const room_t *r = room_at(base + i);
+            gens.gen[i] = r ? r->gen : 0;
+        }
+        if (handoff_send(fd, HO_GENS_REC, &gens, offsetof(ho_gens_t, gen) + gens.n * sizeof(uint32_t), NULL, 0) < 0)
+            return -1;
+    }
+    for (uint32_t slot=0;slot<end->rooms_used;slot++) {
+        room_t *r = room_at(slot);
+        if (!r) continue;
+        pthread_mutex_lock(&r->lock);
+        ho_room_t rec = {
+            .slot = slot, .id = atomic_load_explicit(&r->id, memory_order_relaxed), .player_count = r->player_count,
+            .game = r->game, .players = { r->players[0], r->players[1] }, .deadline_ms = r->deadline_ms,
+            .pub_id = r->pub_id, .pub_players = r->pub_players, .pub_state = r->pub_state, .pending = r->pending,
+        };
+        memcpy(rec.name, r->name, sizeof(rec.name));
+        memcpy(rec.nicks, r->nicks, sizeof(rec.nicks));
+        pthread_mutex_unlock(&r->lock);
+        if (rec.id == 0 && rec.pub_id == 0) continue;
+        if (handoff_send(fd, HO_ROOM, &rec, sizeof(rec), NULL, 0) < 0) return -1;
+        end->rooms++;
+    }
+
+    static ho_session_batch_t batch;
+    batch.fd = fd;
+    batch.rec.n = 0;
+    batch.count = 0;
+    if (session_foreach(reactor_now_ms(), ho_add_session, &batch) != 0 || ho_flush_sessions(&batch) < 0) return -1;
+    end->sessions = batch.count;
+    if (handoff_send(fd, HO_END, end, sizeof(*end), NULL, 0) < 0) return -1;
+
+    uint32_t type;
+    int fds[HANDOFF_MAX_FDS], nfds;
+    ssize_t n = handoff_recv(fd, &type, &cfg, sizeof(cfg), fds, &nfds);
+    for (int i=0;i<nfds;i++) close(fds[i]);
+    return n >= 0 && type == HO_ACK ? 0 : -1;
+}
+
+/* --handoff listener of the running process: serve one successor, then exit */
+static void *handoff_main(void *arg) {
+    int lfd = (int)(intptr_t)arg;
+    for (;;) {
+        int fd = handoff_accept(lfd);
+        if (fd < 0) {
+            if (errno != EINTR) sleep(1);
             continue;
         }
-        if (pthread_create(&c->thread, NULL, client_worker, c) != 0) {
-            perror("pthread_create");
-            unregister_client(c);
-            close(connfd);
-            free(c);
+        uint64_t t0 = metrics_now_ns();
+        LOG(LOG_INFO, "handoff_begin", " workers=%d", config.workers);
+        if (reactor_quiesce(HANDOFF_TIMEOUT_MS) < 0) {
+            LOG(LOG_WARN, "handoff_failed", " reason=quiesce_timeout");
+            close(fd);
             continue;
         }
-        pthread_detach(c->thread);
+        ho_end_t end;
+        if (handoff_export(fd, &end) == 0) {
+            LOG(LOG_INFO, "handoff_done", " clients=%llu rooms=%llu sessions=%llu paused_ms=%llu",
+                (unsigned long long)end.clients, (unsigned long long)end.rooms, (unsigned long long)end.sessions,
+                (unsigned long long)((metrics_now_ns() - t0) / 1000000));
+            journal_flush(); // the successor appends once we are gone
+            log_flush();
+            _exit(0); // the successor holds every socket now
+        }
+        close(fd);
+        reactor_resume();
+        LOG(LOG_WARN, "handoff_failed", " reason=transfer");
     }
+    return NULL;
+}
+
+static void handoff_serve(const char *path) {
+    int fd = handoff_listen(path);
+    pthread_t t;
+    if (pthread_create(&t, NULL, handoff_main, (void *)(intptr_t)fd) != 0) { perror("pthread_create"); exit(1); }
+    pthread_detach(t);
 }
 
+static void handoff_die(const char *why) {
+    fprintf(stderr, "handoff: %s\n", why);
+    exit(1); // the old process gets no ack and carries on
+}
+
+/* new process: set up config, tables and reactors from the old one's records,
+ * ack, and wait for it to exit. No reactor runs yet. */
+static void handoff_import(int fd, ho_end_t *end) {
+    static char buf[HANDOFF_MAX_REC];
+    int fds[HANDOFF_MAX_FDS], nfds;
+    uint32_t type;
+    ssize_t n = handoff_recv(fd, &type, buf, sizeof(buf), fds, &nfds);
+    ho_config_t cfg;
+    if (n != (ssize_t)sizeof(cfg) || type != HO_CONFIG) handoff_die("no config record");
+    memcpy(&cfg, buf, sizeof(cfg));
+    if (cfg.magic != HO_MAGIC || cfg.version != HO_VERSION) handoff_die("incompatible version");
+    if (cfg.workers < 1 || cfg.workers > MAX_WORKERS || nfds != cfg.workers) handoff_die("bad listen fds");
+    if (cfg.cluster_nodes != cluster_nodes || cfg.cluster_self != cluster_self) handoff_die("different --cluster or --node");
+    config.workers = cfg.workers;
+    config.max_clients = cfg.max_clients;
+    config.max_rooms = cfg.max_rooms;
+    config.backlog = cfg.backlog;
+    memcpy(listen_fds, fds, sizeof(int) * (size_t)nfds);
+    tables_init();
+    reactor_init(config.workers, listen_fds);
+
+    ho_end_t got = { 0 };
+    client_t *last = NULL; // HO_OUT records follow their client
+    for (;;) {
+        n = handoff_recv(fd, &type, buf, sizeof(buf), fds, &nfds);
+        if (n < 0 || type == 0) handoff_die("transfer broken");
+        if (nfds != (type == HO_CLIENT)) handoff_die("unexpected fds");
+        switch (type) {
+        case HO_TABLE: {
+            ho_table_t tr;
+            if (n != (ssize_t)sizeof(tr)) handoff_die("bad table record");
+            memcpy(&tr, buf, sizeof(tr));
+            if (tr.idx < 0 || tr.idx >= config.workers || tr.used > (uint32_t)config.max_clients) handoff_die("bad table record");
+            client_table_t *t = &client_tables[tr.idx];
+            t->gen = tr.gen;
+            t->ids.used = tr.used;
+            t->next_ticket = tr.next_ticket;
+            break;
+        }
+        case HO_CLIENT: {
+            const ho_client_t *rec = (const ho_client_t *)buf;
+            if (n < (ssize_t)offsetof(ho_client_t, rbuf) || n != (ssize_t)(offsetof(ho_client_t, rbuf) + rec->rlen))
+                handoff_die("bad client record");
+            int idx = REF_REACTOR(rec->ref), slot = REF_SLOT(rec->ref);
+            if (idx >= config.workers || (uint32_t)slot >= client_tables[idx].ids.used) handoff_die("bad client record");
+            client_t *c = reactor_adopt(idx, fds[0], rec->rbuf, rec->rlen);
+            if (!c) handoff_die("cannot adopt a connection");
+            c->ref = rec->ref;
+            c->state = (client_state_t)rec->state;
+            c->room_id = rec->room_id;
+            c->last_seen_ms = rec->last_seen_ms;
+            c->closing = rec->closing;
+            c->discard = rec->discard;
+            c->binary = rec->binary;
+            c->subscribed = rec->subscribed; // markers for handoff_start
+            c->queue_ticket = rec->queued;
+            c->watch_room = rec->watch_room;
+            memcpy(c->nick, rec->nick, sizeof(c->nick));
+            memcpy(c->token, rec->token, sizeof(c->token));
+            client_tables[idx].slots[slot] = c;
+            last = c;
+            got.clients++;
+            break;
+        }
+        case HO_OUT: {
+            const ho_out_t *rec = (const ho_out_t *)buf;
+            if (n <= (ssize_t)offsetof(ho_out_t, data) || !last || rec->ref != last->ref) handoff_die("bad output record");
+            size_t len = (size_t)n - offsetof(ho_out_t, data);
+            ho_staged_t *st = malloc(sizeof(*st) + len);
+            if (!st) handoff_die("out of memory");
+            st->next = NULL;
+            st->c = last;
+            st->len = len;
+            memcpy(st->data, rec->data, len);
+            int idx = REF_REACTOR(last->ref);
+            if (ho_staged[idx].tail) ho_staged[idx].tail->next = st;
+            else ho_staged[idx].head = st;
+            ho_staged[idx].tail = st;
+            break;
+        }
+        case HO_GENS_REC: {
+            const ho_gens_t *rec = (const ho_gens_t *)buf;
+            if (n < (ssize_t)offsetof(ho_gens_t, gen) || n != (ssize_t)(offsetof(ho_gens_t, gen) + rec->n * sizeof(uint32_t)) ||
+                rec->base + rec->n > (uint32_t)config.max_rooms)
+                handoff_die("bad generations record");
+            for (uint32_t i=0;i<rec->n;i++) {
+                room_t *r = room_chunk_alloc(rec->base + i);
+                if (!r) handoff_die("out of memory");
+                r->gen = rec->gen[i];
+            }
+            break;
+        }
+        case HO_ROOM: {
+            ho_room_t rec;
+            if (n != (ssize_t)sizeof(rec)) handoff_die("bad room record");
+            memcpy(&rec, buf, sizeof(rec));
+            room_t *r = rec.slot < (uint32_t)config.max_rooms ? room_chunk_alloc(rec.slot) : NULL;
+            if (!r) handoff_die("bad room record");
+            r->game = rec.game;
+            r->players[0] = rec.players[0];
+            r->players[1] = rec.players[1];
+            r->player_count = rec.player_count;
+            r->pending = rec.pending;
+            r->deadline_ms = rec.deadline_ms;
+            memcpy(r->name, rec.name, sizeof(r->name));
+            memcpy(r->nicks, rec.nicks, sizeof(r->nicks));
+            r->pub_id = rec.pub_id;
+            r->pub_players = rec.pub_players;
+            r->pub_state = (room_state_t)rec.pub_state;
+            atomic_store_explicit(&r->id, rec.id, memory_order_relaxed);
+            got.rooms++;
+            break;
+        }
+        case HO_SESSIONS_REC: {
+            const ho_sessions_t *rec = (const ho_sessions_t *)buf;
+            if (n < (ssize_t)offsetof(ho_sessions_t, s) || rec->n > HO_SESSIONS ||
+                n != (ssize_t)(offsetof(ho_sessions_t, s) + rec->n * sizeof(session_t)))
+                handoff_die("bad sessions record");
+            for (uint32_t i=0;i<rec->n;i++) {
+                session_t s = rec->s[i];
+                if (session_put(&s, reactor_now_ms()) < 0) LOG(LOG_WARN, "session_dropped", " nick=%s reason=table_full", s.nick);
+            }
+            got.sessions += rec->n;
+            break;
+        }
+        case HO_END:
+            if (n != (ssize_t)sizeof(*end)) handoff_die("bad end record");
+            memcpy(end, buf, sizeof(*end));
+            if (end->clients != got.clients || end->rooms != got.rooms || end->sessions != got.sessions ||
+                end->rooms_used > (uint32_t)config.max_rooms)
+                handoff_die("records missing");
+            goto done;
+        default:
+            handoff_die("unknown record");
+        }
+    }
+done:
+    /* free stacks: every slot handed out before and empty now */
+    for (int i=0;i<config.workers;i++) {
+        client_table_t *t = &client_tables[i];
+        for (uint32_t slot=t->ids.used;slot-->0;) if (!t->slots[slot]) slot_put(&t->ids, (int)slot);
+    }
+    room_slots.used = end->rooms_used;
+    for (uint32_t slot=end->rooms_used;slot-->0;) {
+        room_t *r = room_at(slot);
+        if (!r || atomic_load_explicit(&r->id, memory_order_relaxed) == 0) slot_put(&room_slots, (int)slot);
+    }
+    if (handoff_send(fd, HO_ACK, NULL, 0, NULL, 0) < 0) handoff_die("cannot ack");
+    /* the old process exits after the ack; wait, so its admin port and PATH are free */
+    do n = handoff_recv(fd, &type, buf, sizeof(buf), fds, &nfds);
+    while (n > 0 || (n == 0 && type != 0));
+    close(fd);
+}
+
+/* every reactor, before any handles an event: re-arm what the old process
+ * had running for the clients and rooms this one owns */
+static void handoff_start(void) {
+    int me = reactor_index();
+    client_table_t *t = &client_tables[me];
+    uint64_t now = reactor_now_ms();
+    /* unsent output first, ahead of anything queued below */
+    for (ho_staged_t *st = ho_staged[me].head, *next; st; st = next) {
+        next = st->next;
+        if (!st->c->dead && outq_append(&st->c->out, st->data, st->len) < 0) {
+            LOG(LOG_ERROR, "handoff_output_lost", " fd=%d bytes=%zu", st->c->fd, st->len);
+            conn_drop(st->c); // a gap in its stream would be worse
+        }
+        free(st);
+    }
+    ho_staged[me].head = ho_staged[me].tail = NULL;
+    for (uint32_t slot=0;slot<t->ids.used;slot++) {
+        client_t *c = t->slots[slot];
+        if (!c) continue;
+        metrics_add(MET_ADOPTED, 1);
+        uint64_t idle = now > c->last_seen_ms ? now - c->last_seen_ms : 0;
+        c->idle_timer.cb = client_idle_expired;
+        reactor_timer_arm(&c->idle_timer, idle < KEEPALIVE_MS ? KEEPALIVE_MS - idle : 0);
+        if (c->subscribed) {
+            c->subscribed = 0;
+            lobby_subscribe(c);
+        }
+        if (c->queue_ticket) { // the old ring is gone: queue again, behind nobody it was ahead of
+            c->queue_ticket = 0;
+            if (queue_join(c) < 0) send_lit(c, "ERR 200 SERVER_FULL");
+        }
+        /* rooms arrive without their spectators; a room closed meanwhile was announced already */
+        room_t *w = c->watch_room ? lock_room_by_id(c->watch_room) : NULL;
+        if (w) {
+            if (watch_add(w, c->ref) < 0) c->watch_room = 0;
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+    for (uint32_t slot=(uint32_t)me;slot<room_slots.used;slot+=(uint32_t)reactor_count()) {
+        room_t *r = room_at(slot);
+        if (!r) continue;
+        pthread_mutex_lock(&r->lock);
+        int id = atomic_load_explicit(&r->id, memory_order_relaxed);
+        if (id) metrics_add(MET_ROOMS_ADOPTED, 1);
+        if (id || r->pub_id) rooms_changed(r); // indexes it; the lobby diff sends what a lost batch held
+        if (r->deadline_ms) reactor_timer_arm(&r->timer, r->deadline_ms > now ? r->deadline_ms - now : 0);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+static int taking_over; // started with --handoff PATH of a running server
+
+/* every reactor, before any handles an event */
+static void reactors_started(void) {
+    if (taking_over) handoff_start();
+    if (cluster_nodes && reactor_index() == LOBBY_REACTOR) reactor_timer_arm(&cluster_timer, LOBBY_BATCH_MS);
+}
+
+/* ---- journal replay ----
+ * A cold start rebuilds the suspended sessions from the journal. A session
+ * that was suspended keeps what is left of its window; one still connected
+ * when the process went away gets a whole RECONNECT_WINDOW, as if it had
+ * dropped just now. Rooms do not survive, so every one resumes in the lobby. */
+
+typedef struct {
+    uint64_t mono_ms, real_ms; // the same instant on both clocks
+    size_t records;
+} replay_clock_t;
+
+static void replay_session(const char *token, const char *nick, uint64_t expires_ms, uint64_t now_ms) {
+    session_t s = { .room_id = 0, .seat = -1, .expires_ms = expires_ms };
+    memcpy(s.token, token, sizeof(s.token));
+    memcpy(s.nick, nick, sizeof(s.nick));
+    s.token[TOKEN_LEN] = s.nick[NICK_MAX] = '\0';
+    if (session_put(&s, now_ms) < 0) LOG(LOG_WARN, "session_dropped", " nick=%s reason=table_full", s.nick);
+}
+
+/* whatever the table holds for token so far is superseded */
+static void replay_forget(const char *token) {
+    session_t old;
+    session_take(token, strnlen(token, TOKEN_LEN), 0, &old);
+}
+
+static void replay_record(const journal_hdr_t *h, const void *p, void *arg) {
+    replay_clock_t *now = arg;
+    switch (h->type) {
+    case J_SESSION_NEW:
+    case J_SESSION_RESUME: {
+        const j_session_t *j = p;
+        if (h->len != sizeof(*j)) return;
+        replay_forget(j->token);
+        replay_session(j->token, j->nick, now->mono_ms + RECONNECT_WINDOW_MS, now->mono_ms);
+        break;
+    }
+    case J_SESSION_SUSPEND: {
+        const j_suspend_t *j = p;
+        if (h->len != sizeof(*j)) return;
+        replay_forget(j->token);
+        if (j->expires_ms > now->real_ms) replay_session(j->token, j->nick, now->mono_ms + (j->expires_ms - now->real_ms), now->mono_ms);
+        break;
+    }
+    case J_SESSION_END:
+        if (h->len == sizeof(j_session_t)) replay_forget(((const j_session_t *)p)->token);
+        break;
+    default: // rooms and results are for readers of the journal
+        break;
+    }
+    now->records++;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--workers N] [--max-clients N] [--max-rooms N] [--backlog N]\n"
+                    "          [--sndbuf BYTES] [--rcvbuf BYTES] [--log-level LEVEL]\n"
+                    "          [--admin-port PORT] [--journal PATH] [--journal-fsync-ms MS]\n"
+                    "          [--handoff PATH] [--io epoll|uring] [--cmd-rate N]\n"
+                    "          [--cluster HOST:PORT,... --node I] [port]\n", prog);
+    fprintf(stderr, "  --max-clients is per worker (default %d), --max-rooms for the server (default %d)\n",
+            DEFAULT_MAX_CLIENTS, DEFAULT_MAX_ROOMS);
+    fprintf(stderr, "  --backlog defaults to %d; socket buffers to kernel autotuning\n", DEFAULT_BACKLOG);
+    fprintf(stderr, "  --log-level debug|info|warn|error (default info); SIGUSR1/SIGUSR2 raise/lower it\n");
+    fprintf(stderr, "  --admin-port serves Prometheus metrics on 127.0.0.1 (default off)\n");
+    fprintf(stderr, "  --journal appends sessions, rooms and results to PATH and replays it on start;\n"
+                    "            --journal-fsync-ms bounds how much a crash loses (default %d, 0 = every batch)\n",
+            DEFAULT_JOURNAL_FSYNC_MS);
+    fprintf(stderr, "  --handoff: Unix socket for hot restarts; a server started with the PATH of a\n"
+                    "             running one takes its sockets, clients and games over, settings included\n");
+    fprintf(stderr, "  --io: socket I/O on epoll (default) or io_uring; uring falls back to epoll where the\n"
+                    "        kernel lacks it, and cannot be combined with --handoff\n");
+    fprintf(stderr, "  --cmd-rate: commands per second a connection may sustain, %d s of them at once;\n"
+                    "             faster ones are disconnected (default %d, 0 = unlimited, e.g. for loadgen)\n",
+            CMD_BURST_S, DEFAULT_CMD_RATE);
+    fprintf(stderr, "  --cluster: the public address of every node (up to %d), the same list on each;\n"
+                    "             --node is this one's index in it. Rooms and sessions stay on the node\n"
+                    "             that made them, the others answer REDIRECT and show them in LIST\n",
+            CLUSTER_MAX_NODES);
+    exit(2);
+}
+
+/* --option value in [lo, hi], or usage() */
+static int int_arg(const char *prog, const char *s, int lo, int hi) {
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < lo || v > hi) usage(prog);
+    return (int)v;
+}
+
+int main(int argc, char **argv) {
+    const char *port = "10000";
+    int level = LOG_INFO;
+    int admin_port = 0;
+    const char *handoff = NULL;
+    const char *journal = NULL;
+    int journal_fsync_ms = DEFAULT_JOURNAL_FSYNC_MS;
+    const char *cluster = NULL;
+    int node = -1;
+    static const struct option longopts[] = {
+        { "workers", required_argument, NULL, 'w' },
+        { "max-clients", required_argument, NULL, 'c' },
+        { "max-rooms", required_argument, NULL, 'r' },
+        { "backlog", required_argument, NULL, 'b' },
+        { "sndbuf", required_argument, NULL, 'S' },
+        { "rcvbuf", required_argument, NULL, 'R' },
+        { "log-level", required_argument, NULL, 'l' },
+        { "admin-port", required_argument, NULL, 'A' },
+        { "handoff", required_argument, NULL, 'H' },
+        { "journal", required_argument, NULL, 'J' },
+        { "journal-fsync-ms", required_argument, NULL, 'F' },
+        { "io", required_argument, NULL, 'I' },
+        { "cmd-rate", required_argument, NULL, 'C' },
+        { "cluster", required_argument, NULL, 'K' },
+        { "node", required_argument, NULL, 'N' },
+        { NULL, 0, NULL, 0 }
+    };
+    int ch;
+    while ((ch = getopt_long(argc, argv, "w:c:r:b:", longopts, NULL)) != -1) {
+        switch (ch) {
+        case 'w': config.workers = int_arg(argv[0], optarg, 1, MAX_WORKERS); break;
+        case 'c': config.max_clients = int_arg(argv[0], optarg, 1, MAX_CLIENTS_LIMIT); break;
+        case 'r': config.max_rooms = int_arg(argv[0], optarg, 1, MAX_ROOMS_LIMIT); break;
+        case 'b': config.backlog = int_arg(argv[0], optarg, 1, 1 << 20); break;
+        case 'S': config.sndbuf = int_arg(argv[0], optarg, 4096, 1 << 30); break;
+        case 'R': config.rcvbuf = int_arg(argv[0], optarg, 4096, 1 << 30); break;
+        case 'A': admin_port = int_arg(argv[0], optarg, 1, 65535); break;
+        case 'H': handoff = optarg; break;
+        case 'J': journal = optarg; break;
+        case 'F': journal_fsync_ms = int_arg(argv[0], optarg, 0, 60000); break;
+        case 'C': config.cmd_rate = int_arg(argv[0], optarg, 0, CMD_RATE_LIMIT); break;
+        case 'K': cluster = optarg; break;
+        case 'N': node = int_arg(argv[0], optarg, 0, CLUSTER_MAX_NODES - 1); break;
+        case 'I':
+            if (strcmp(optarg, "epoll") == 0) config.io = IO_EPOLL;
+            else if (strcmp(optarg, "uring") == 0) config.io = IO_URING;
+            else usage(argv[0]);
+            break;
+        case 'l':
+            level = log_parse_level(optarg);
+            if (level < 0) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc) port = argv[optind];
+    /* a handoff passes fds with requests of ours still pending on them */
+    if (handoff && config.io == IO_URING) usage(argv[0]);
+    if (!cluster != (node < 0) || (cluster && cluster_parse(cluster, node) < 0)) usage(argv[0]);
+
+    log_init((log_level_t)level);
+    if (config.io == IO_URING && !uring_supported()) {
+        LOG(LOG_WARN, "io_uring_unavailable", " fallback=epoll");
+        config.io = IO_EPOLL;
+    }
+    metrics_init(cmd_names, CMD_COUNT);
+    int hfd = handoff ? handoff_connect(handoff) : -1; // -1: nobody to take over from
+    if (hfd >= 0) {
+        ho_end_t got;
+        handoff_import(hfd, &got);
+        LOG(LOG_INFO, "takeover", " workers=%d max_clients=%d max_rooms=%d backlog=%d clients=%llu rooms=%llu sessions=%llu",
+            config.workers, config.max_clients, config.max_rooms, config.backlog, (unsigned long long)got.clients,
+            (unsigned long long)got.rooms, (unsigned long long)got.sessions);
+    } else {
+        int workers = config.workers;
+        tables_init();
+        for (int i=0;i<workers;i++) listen_fds[i] = net_listen(atoi(port), workers > 1);
+        LOG(LOG_INFO, "listen", " addr=0.0.0.0:%s workers=%d max_clients=%d max_rooms=%d backlog=%d io=%s", port, workers,
+            config.max_clients, config.max_rooms, config.backlog, config.io == IO_URING ? "uring" : "epoll");
+        reactor_init(workers, listen_fds);
+    }
+    if (journal) {
+        /* after a takeover the sessions came with it: append only */
+        replay_clock_t now = { reactor_now_ms(), realtime_ms(), 0 };
+        journal_open(journal, journal_fsync_ms, hfd >= 0 ? NULL : replay_record, &now);
+        LOG(LOG_INFO, "journal_open", " path=%s replayed=%zu fsync_ms=%d", journal, now.records, journal_fsync_ms);
+    }
+    if (admin_port) {
+        metrics_serve(admin_port);
+        LOG(LOG_INFO, "admin_listen", " addr=127.0.0.1:%d", admin_port);
+    }
+    if (handoff) {
+        handoff_serve(handoff);
+        LOG(LOG_INFO, "handoff_listen", " path=%s", handoff);
+    }
+
+    if (cluster_nodes) {
+        cluster_start(cluster_changed);
+        LOG(LOG_INFO, "cluster", " nodes=%d node=%d", cluster_nodes, cluster_self);
+    }
+
+    taking_over = hfd >= 0;
+    reactor_start(reactors_started);
+}
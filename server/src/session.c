@@ -0,0 +1,139 @@
+// session.c
+// Sharded open-addressing table of suspended sessions. The low hash bits
+// pick the shard, the rest the home slot; deletion shifts the cluster back
+// so lookups can stop at the first free slot (no tombstones).
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "session.h"
+
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    size_t used; // occupied slots, expired ones included
+    session_t *slots; // nslots entries
+} shard_t;
+
+static shard_t shards[SESSION_SHARDS] = {
+#define SHARD_INIT { .lock = PTHREAD_MUTEX_INITIALIZER }
+    [0 ... SESSION_SHARDS-1] = SHARD_INIT,
+#undef SHARD_INIT
+};
+static size_t nslots; // per shard, power of two
+
+/* floor(sqrt(x)) */
+static size_t isqrt(size_t x) {
+    size_t r = 0;
+    while ((r + 1) * (r + 1) <= x) r++;
+    return r;
+}
+
+int session_init(size_t max_sessions) {
+    /* the hash spreads max_sessions binomially over the shards: size each for
+     * its share plus 4 standard deviations, so no shard fills before the
+     * table does, and keep that under 3/4 full */
+    size_t share = (max_sessions + SESSION_SHARDS - 1) / SESSION_SHARDS;
+    size_t want = (share + 4 * isqrt(share) + 1) / 3 * 4 + 4;
+    nslots = SESSION_MIN_SLOTS;
+    while (nslots < want) nslots *= 2;
+    for (int i=0;i<SESSION_SHARDS;i++) {
+        shards[i].slots = calloc(nslots, sizeof(session_t));
+        if (!shards[i].slots) return -1;
+    }
+    return 0;
+}
+
+/* FNV-1a; tokens are random, this only has to spread them */
+static uint64_t token_hash(const char *p, size_t n) {
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i=0;i<n;i++) { h ^= (unsigned char)p[i]; h *= 1099511628211ull; }
+    return h;
+}
+
+static shard_t *shard_of(uint64_t h) {
+    return &shards[h & (SESSION_SHARDS - 1)];
+}
+
+static size_t home_of(uint64_t h) {
+    return (size_t)(h / SESSION_SHARDS) & (nslots - 1);
+}
+
+/* free slot i and pull later members of its cluster back over the hole */
+static void shard_erase(shard_t *sh, size_t i) {
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & (nslots - 1);
+        if (sh->slots[j].token[0] == '\0') break;
+        size_t home = home_of(sh->slots[j].hash);
+        /* j may move to i unless its home lies cyclically in (i, j] */
+        int stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+        if (stays) continue;
+        sh->slots[i] = sh->slots[j];
+        i = j;
+    }
+    sh->slots[i].token[0] = '\0';
+    sh->used--;
+}
+
+/* drop every expired entry; only when the shard fills up. The walk starts
+ * after a free slot (put keeps a quarter free): shard_erase never moves an
+ * entry across one, so a run wrapping past the last slot is seen whole. */
+static void shard_purge(shard_t *sh, uint64_t now_ms) {
+    size_t start = 0;
+    while (sh->slots[start].token[0] != '\0') start++;
+    for (size_t k=1;k<=nslots;) {
+        size_t i = (start + k) & (nslots - 1);
+        session_t *s = &sh->slots[i];
+        if (s->token[0] != '\0' && s->expires_ms <= now_ms) shard_erase(sh, i); // slot i refilled, look again
+        else k++;
+    }
+}
+
+int session_put(session_t *s, uint64_t now_ms) {
+    size_t n = strnlen(s->token, TOKEN_LEN);
+    s->hash = token_hash(s->token, n);
+    shard_t *sh = shard_of(s->hash);
+    pthread_mutex_lock(&sh->lock);
+    if (sh->used >= nslots / 4 * 3) shard_purge(sh, now_ms);
+    if (sh->used >= nslots / 4 * 3) { pthread_mutex_unlock(&sh->lock); return -1; }
+    /* tokens are unique, so the first free or expired slot of the probe will do */
+    size_t i = home_of(s->hash);
+    while (sh->slots[i].token[0] != '\0' && sh->slots[i].expires_ms > now_ms) i = (i + 1) & (nslots - 1);
+    if (sh->slots[i].token[0] == '\0') sh->used++;
+    sh->slots[i] = *s;
+    pthread_mutex_unlock(&sh->lock);
+    return 0;
+}
+
+int session_take(const char *token, size_t len, uint64_t now_ms, session_t *out) {
+    if (len == 0 || len > TOKEN_LEN) return -1;
+    uint64_t h = token_hash(token, len);
+    shard_t *sh = shard_of(h);
+    int rc = -1;
+    pthread_mutex_lock(&sh->lock);
+    for (size_t i = home_of(h); sh->slots[i].token[0] != '\0'; i = (i + 1) & (nslots - 1)) {
+        session_t *s = &sh->slots[i];
+        if (s->hash != h || strncmp(s->token, token, len) != 0 || s->token[len] != '\0') continue;
+        if (s->expires_ms > now_ms) { *out = *s; rc = 0; }
+        shard_erase(sh, i);
+        break;
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return rc;
+}
+
+int session_foreach(uint64_t now_ms, int (*fn)(const session_t *s, void *arg), void *arg) {
+    for (int k=0;k<SESSION_SHARDS;k++) {
+        shard_t *sh = &shards[k];
+        int rc = 0;
+        pthread_mutex_lock(&sh->lock);
+        for (size_t i=0;i<nslots && rc == 0;i++) {
+            const session_t *s = &sh->slots[i];
+            if (s->token[0] != '\0' && s->expires_ms > now_ms) rc = fn(s, arg);
+        }
+        pthread_mutex_unlock(&sh->lock);
+        if (rc) return rc;
+    }
+    return 0;
+}
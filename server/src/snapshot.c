@@ -0,0 +1,62 @@
+// snapshot.c
+// Hazard-pointer protected publication of reference-counted snapshots.
+
+#include <stdlib.h>
+
+#include "server.h"
+#include "reactor.h"
+#include "snapshot.h"
+
+/* hazards[r]: the snapshot reactor r is about to take a reference on */
+static struct {
+    _Alignas(64) _Atomic(snapshot_t *) p;
+} hazards[MAX_WORKERS];
+
+snapshot_t *snapshot_alloc(size_t cap) {
+    snapshot_t *s = malloc(sizeof(*s) + cap);
+    if (!s) return NULL;
+    atomic_init(&s->refs, 1);
+    s->version = 0;
+    s->len = 0;
+    return s;
+}
+
+snapshot_t *snapshot_acquire(snapshot_slot_t *slot) {
+    _Atomic(snapshot_t *) *hp = &hazards[reactor_index()].p;
+    snapshot_t *s;
+    do {
+        s = atomic_load(&slot->cur);
+        atomic_store(hp, s);
+    } while (s != atomic_load(&slot->cur)); // re-check: s cannot be retired past our hazard now
+    if (s) atomic_fetch_add_explicit(&s->refs, 1, memory_order_relaxed);
+    atomic_store_explicit(hp, NULL, memory_order_release);
+    return s;
+}
+
+void snapshot_put(snapshot_t *s) {
+    if (s && atomic_fetch_sub_explicit(&s->refs, 1, memory_order_acq_rel) == 1) free(s);
+}
+
+static int hazarded(const snapshot_t *s) {
+    for (int i=0;i<MAX_WORKERS;i++) if (atomic_load(&hazards[i].p) == s) return 1;
+    return 0;
+}
+
+void snapshot_publish(snapshot_slot_t *slot, snapshot_t *s) {
+    snapshot_t *old = atomic_exchange(&slot->cur, s);
+    if (old) {
+        if (slot->nretired == (int)(sizeof(slot->retired) / sizeof(slot->retired[0]))) {
+            /* hazards are held for a handful of instructions; wait them out */
+            while (hazarded(slot->retired[0])) ;
+            snapshot_put(slot->retired[0]);
+            slot->retired[0] = slot->retired[--slot->nretired];
+        }
+        slot->retired[slot->nretired++] = old;
+    }
+    /* drop the slot's reference on everything nobody is still grabbing */
+    for (int i=0;i<slot->nretired;) {
+        if (hazarded(slot->retired[i])) { i++; continue; }
+        snapshot_put(slot->retired[i]);
+        slot->retired[i] = slot->retired[--slot->nretired];
+    }
+}
@@ -0,0 +1,93 @@
+// timerwheel.c
+// Level 0 holds timers due within 64 ticks, level n those due within
+// 64^(n+1). When level n-1 wraps, one slot of level n is cascaded down.
+
+#include "timerwheel.h"
+
+static void list_init(tw_timer_t *head) {
+    head->prev = head->next = head;
+}
+
+static void unlink_timer(tw_timer_t *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+/* link t into its slot; expires == now only happens while cascading, before
+ * level 0 of the current tick is run */
+static void place(timer_wheel_t *tw, tw_timer_t *t) {
+    uint64_t delta = t->expires - tw->now;
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (1ull << (TW_BITS * (level + 1)))) level++;
+    if (delta >= (1ull << (TW_BITS * TW_LEVELS))) t->expires = tw->now + (1ull << (TW_BITS * TW_LEVELS)) - 1;
+    tw_timer_t *head = &tw->slots[level][(t->expires >> (TW_BITS * level)) & (TW_SLOTS - 1)];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+void tw_init(timer_wheel_t *tw, uint64_t now_ms) {
+    tw->now = 0;
+    tw->start_ms = now_ms;
+    tw->count = 0;
+    for (int l=0;l<TW_LEVELS;l++) for (int s=0;s<TW_SLOTS;s++) list_init(&tw->slots[l][s]);
+}
+
+void tw_arm(timer_wheel_t *tw, tw_timer_t *t, uint64_t delay_ms) {
+    if (tw_armed(t)) unlink_timer(t);
+    else tw->count++;
+    t->expires = tw->now + (delay_ms + TW_TICK_MS - 1) / TW_TICK_MS;
+    if (t->expires == tw->now) t->expires++; // the current slot has already run
+    place(tw, t);
+}
+
+void tw_cancel(timer_wheel_t *tw, tw_timer_t *t) {
+    if (!tw_armed(t)) return;
+    unlink_timer(t);
+    tw->count--;
+}
+
+/* re-place every timer of one slot at level >= 1 into the lower levels */
+static void cascade(timer_wheel_t *tw, int level) {
+    tw_timer_t *head = &tw->slots[level][(tw->now >> (TW_BITS * level)) & (TW_SLOTS - 1)];
+    tw_timer_t list;
+    if (head->next == head) return;
+    /* detach the whole slot first: place() may put timers back at this level */
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    list_init(head);
+    while (list.next != &list) {
+        tw_timer_t *t = list.next;
+        unlink_timer(t);
+        place(tw, t);
+    }
+}
+
+void tw_advance(timer_wheel_t *tw, uint64_t now_ms) {
+    uint64_t target = (now_ms - tw->start_ms) / TW_TICK_MS;
+    while (tw->now < target) {
+        tw->now++;
+        if (tw->count == 0) { tw->now = target; break; } // nothing to cascade or run
+        for (int l=1;l<TW_LEVELS;l++) {
+            if ((tw->now & ((1ull << (TW_BITS * l)) - 1)) != 0) break;
+            cascade(tw, l);
+        }
+        tw_timer_t *head = &tw->slots[0][tw->now & (TW_SLOTS - 1)];
+        while (head->next != head) {
+            tw_timer_t *t = head->next;
+            unlink_timer(t);
+            tw->count--;
+            t->cb(t);
+        }
+    }
+}
+
+int tw_timeout_ms(const timer_wheel_t *tw, uint64_t now_ms) {
+    if (tw->count == 0) return -1;
+    uint64_t next_ms = tw->start_ms + (tw->now + 1) * TW_TICK_MS;
+    return next_ms > now_ms ? (int)(next_ms - now_ms) : 0;
+}
@@ -0,0 +1,69 @@
+// token.c
+// No locks, no seeding: each thread draws from its own pool, and
+// getrandom() is only called once every TOKEN_POOL / (TOKEN_LEN/2) tokens.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "token.h"
+
+#define TOKEN_BYTES ((TOKEN_LEN + 1) / 2)
+
+_Static_assert(TOKEN_BYTES <= 16, "hex_encode16 covers one 16-byte block");
+
+static __thread unsigned char pool[TOKEN_POOL];
+static __thread size_t pool_off = TOKEN_POOL; // empty until first use
+
+static void pool_refill(void) {
+    size_t got = 0;
+    while (got < sizeof(pool)) {
+        ssize_t n = getrandom(pool + got, sizeof(pool) - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("getrandom");
+            exit(1); // no safe fallback for session secrets
+        }
+        got += (size_t)n;
+    }
+    pool_off = 0;
+}
+
+/* 16 bytes -> 32 lowercase hex digits */
+static void hex_encode16(const unsigned char *in, char *out) {
+#if defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *)in);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    __m128i lo = _mm_and_si128(v, mask);
+    /* interleave so the high nibble of each byte comes first */
+    __m128i a = _mm_unpacklo_epi8(hi, lo);
+    __m128i b = _mm_unpackhi_epi8(hi, lo);
+    /* '0' + n, plus 'a'-'0'-10 where n > 9 */
+    __m128i nine = _mm_set1_epi8(9), zero = _mm_set1_epi8('0'), gap = _mm_set1_epi8('a' - '0' - 10);
+    a = _mm_add_epi8(_mm_add_epi8(a, zero), _mm_and_si128(_mm_cmpgt_epi8(a, nine), gap));
+    b = _mm_add_epi8(_mm_add_epi8(b, zero), _mm_and_si128(_mm_cmpgt_epi8(b, nine), gap));
+    _mm_storeu_si128((__m128i *)out, a);
+    _mm_storeu_si128((__m128i *)(out + 16), b);
+#else
+    static const char hex[] = "0123456789abcdef";
+    for (int i=0;i<16;i++) {
+        out[2*i] = hex[in[i] >> 4];
+        out[2*i+1] = hex[in[i] & 15];
+    }
+#endif
+}
+
+void token_generate(char *out) {
+    if (pool_off + 16 > sizeof(pool)) pool_refill();
+    char hex[32];
+    hex_encode16(pool + pool_off, hex); // reads 16, only TOKEN_BYTES of them are used
+    pool_off += TOKEN_BYTES;
+    memcpy(out, hex, TOKEN_LEN);
+    out[TOKEN_LEN] = '\0';
+}
@@ -0,0 +1,157 @@
+// uring.c
+// Ring setup, submission and waiting for uring.h.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned n) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+int uring_init(uring_t *u, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    /* completions are only worked off when we wait for them: one batch per loop iteration */
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+    int fd = sys_setup(entries, &p);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_SUBMIT_ALL;
+        fd = sys_setup(entries, &p);
+    }
+    if (fd < 0) return -errno;
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(fd);
+        return -ENOSYS;
+    }
+    memset(u, 0, sizeof(*u));
+    u->fd = fd;
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sq_map_len = sq_len > cq_len ? sq_len : cq_len; // one mapping for both rings
+    u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (u->sq_map == MAP_FAILED) { close(fd); return -errno; }
+    u->cq_map = u->sq_map;
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) { munmap(u->sq_map, u->sq_map_len); close(fd); return -errno; }
+    char *sq = u->sq_map, *cq = u->cq_map;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i=0;i<u->sq_entries;i++) u->sq_array[i] = i; // SQE i always sits in slot i
+    u->sq_local = *u->sq_tail;
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+/* make the SQEs handed out so far visible to the kernel */
+static void publish(uring_t *u) {
+    unsigned tail = *u->sq_tail;
+    if (u->sq_local == tail) return;
+    u->sq_pending += u->sq_local - tail;
+    atomic_store_explicit((_Atomic unsigned *)u->sq_tail, u->sq_local, memory_order_release);
+}
+
+static int submit(uring_t *u, unsigned wait, unsigned flags, void *arg, size_t argsz) {
+    publish(u);
+    int n = sys_enter(u->fd, u->sq_pending, wait, flags, arg, argsz);
+    if (n < 0) return -errno;
+    u->sq_pending -= (unsigned)n < u->sq_pending ? (unsigned)n : u->sq_pending;
+    return 0;
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *u) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)u->sq_head, memory_order_acquire);
+    if (u->sq_local - head == u->sq_entries) {
+        int rc;
+        do rc = submit(u, 0, 0, NULL, 0);
+        while (rc == -EINTR);
+        if (rc < 0) return NULL;
+        head = atomic_load_explicit((_Atomic unsigned *)u->sq_head, memory_order_acquire);
+        if (u->sq_local - head == u->sq_entries) return NULL;
+    }
+    struct io_uring_sqe *sqe = &u->sqes[u->sq_local & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_local++;
+    return sqe;
+}
+
+int uring_wait(uring_t *u, int timeout_ms) {
+    /* GETEVENTS even when not waiting: with DEFER_TASKRUN that is when completions get posted */
+    struct __kernel_timespec ts = { timeout_ms / 1000, (long long)(timeout_ms % 1000) * 1000000 };
+    struct io_uring_getevents_arg arg = { .sigmask = 0, .sigmask_sz = _NSIG / 8, .ts = timeout_ms > 0 ? (uint64_t)(uintptr_t)&ts : 0 };
+    return submit(u, timeout_ms != 0, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+int uring_bufs_init(uring_t *u, uring_bufs_t *b, uint16_t group, unsigned count, unsigned size) {
+    size_t ring_len = count * sizeof(struct io_uring_buf);
+    void *ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) return -errno;
+    b->base = aligned_alloc(64, (size_t)count * size);
+    if (!b->base) { munmap(ring, ring_len); return -ENOMEM; }
+    b->ring = ring;
+    b->mask = count - 1;
+    b->size = size;
+    b->tail = 0;
+    b->group = group;
+    struct io_uring_buf_reg reg = { .ring_addr = (uint64_t)(uintptr_t)ring, .ring_entries = count, .bgid = group };
+    if (sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = errno;
+        free(b->base);
+        munmap(ring, ring_len);
+        return -err;
+    }
+    for (unsigned i=0;i<count;i++) uring_buf_put(b, i);
+    uring_bufs_commit(b);
+    return 0;
+}
+
+/* only for a ring that is closed already: the kernel no longer looks at it */
+static void bufs_free(uring_bufs_t *b) {
+    munmap(b->ring, (b->mask + 1) * sizeof(struct io_uring_buf));
+    free(b->base);
+}
+
+int uring_supported(void) {
+    uring_t u;
+    if (uring_init(&u, 8) < 0) return 0;
+    struct {
+        struct io_uring_probe p;
+        struct io_uring_probe_op ops[IORING_OP_LAST];
+    } probe;
+    memset(&probe, 0, sizeof(probe));
+    int ok = sys_register(u.fd, IORING_REGISTER_PROBE, &probe, IORING_OP_LAST) == 0;
+    static const int need[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL };
+    for (size_t i=0;ok && i<sizeof(need)/sizeof(need[0]);i++)
+        ok = need[i] <= probe.p.last_op && (probe.ops[need[i]].flags & IO_URING_OP_SUPPORTED);
+    uring_bufs_t b;
+    int bufs = ok && uring_bufs_init(&u, &b, 0, 2, 64) == 0; // provided buffer rings: 5.19
+    munmap(u.sqes, u.sqes_len);
+    munmap(u.sq_map, u.sq_map_len);
+    close(u.fd);
+    if (bufs) bufs_free(&b);
+    return bufs;
+}